@@ -0,0 +1,39 @@
+#include "../src/platform/linux/coro.h"
+#include <stdio.h>
+#include <time.h>
+
+#define ROUNDS 5000000
+
+#ifdef CORO_UCONTEXT
+#define BACKEND "ucontext"
+#else
+#define BACKEND "asm"
+#endif
+
+static void ping_pong(void *arg) {
+    (void) arg;
+    for (int i = 0; i < ROUNDS; ++i) {
+        coro_yield();
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+    coro_spawn(ping_pong, NULL);
+    coro_spawn(ping_pong, NULL);
+
+    double start = now_ns();
+    coro_start();
+    double elapsed = now_ns() - start;
+
+    // Every yield is two switches: into the scheduler and out to the other coroutine
+    double switches = 2.0 * 2.0 * ROUNDS;
+    printf("%-10s %8.1f ns/switch\n", BACKEND, elapsed / switches);
+
+    return 0;
+}
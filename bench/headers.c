@@ -0,0 +1,118 @@
+#include "feather.h"
+#include "strview.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 2000000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char request[] =
+    "GET /static/css/main.3f2a9c.css HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Referer: https://www.example.com/articles/2024/simd-parsing\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "If-None-Match: \"3f2a9c-1a2b\"\r\n"
+    "If-Modified-Since: Tue, 14 May 2024 09:12:44 GMT\r\n"
+    "\r\n";
+
+// What a request to a static file or a cached route looks up
+static const struct { const char *name; FeatherHeaderId id; } lookups[] = {
+    { "Transfer-Encoding", FEATHER_HEADER_TRANSFER_ENCODING },
+    { "Expect", FEATHER_HEADER_EXPECT },
+    { "Accept-Encoding", FEATHER_HEADER_ACCEPT_ENCODING },
+    { "If-None-Match", FEATHER_HEADER_IF_NONE_MATCH },
+    { "If-Modified-Since", FEATHER_HEADER_IF_MODIFIED_SINCE },
+    { "Range", FEATHER_HEADER_RANGE },
+    { "If-Range", FEATHER_HEADER_IF_RANGE },
+    { "Sec-CH-UA-Platform", FEATHER_HEADER_OTHER },
+};
+
+#define LOOKUP_COUNT (sizeof(lookups) / sizeof(lookups[0]))
+
+static int legacy_ieq(StrView a, StrView b) {
+    if (a.len != b.len) return 0;
+    for (size_t i = 0; i < a.len; ++i) {
+        if (tolower(a.ptr[i]) != tolower(b.ptr[i])) return 0;
+    }
+    return 1;
+}
+
+// How lookups went before interning: the named fields one by one, then every other header
+static StrView legacy_get(const FeatherHeaders *headers, StrView key) {
+    if (legacy_ieq(key, SV_LIT("Authorization"))) return headers->authorization;
+    if (legacy_ieq(key, SV_LIT("Cookie"))) return headers->cookie;
+    if (legacy_ieq(key, SV_LIT("Content-Type"))) return headers->content_type;
+    if (legacy_ieq(key, SV_LIT("Content-Length"))) return headers->content_length;
+    if (legacy_ieq(key, SV_LIT("Connection"))) return headers->connection;
+
+    darr_foreach(FeatherHeader, &headers->other, header) {
+        if (legacy_ieq(header->key, key)) return header->value;
+    }
+    return sv_from_buf(NULL, 0);
+}
+
+int main(void) {
+    FeatherRequest req = {0};
+    feather_parse_request(&req, sv_from_buf(request, sizeof(request) - 1));
+
+    StrView names[LOOKUP_COUNT];
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        names[i] = sv_from_cstr(lookups[i].name);
+
+        StrView a = legacy_get(&req.headers, names[i]);
+        StrView b = feather_get_header(&req.headers, names[i]);
+        StrView c = lookups[i].id ? feather_get_header_id(&req.headers, lookups[i].id) : b;
+        if (feather_header_id(names[i]) != lookups[i].id || !sv_eq(a, b) || !sv_eq(a, c)) {
+            fprintf(stderr, "lookup mismatch on %s\n", lookups[i].name);
+            return 1;
+        }
+    }
+
+    size_t sum = 0;
+
+    double start = now_ns();
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < LOOKUP_COUNT; ++i) sum += legacy_get(&req.headers, names[i]).len;
+    }
+    double legacy_ns = (now_ns() - start) / (ROUNDS * LOOKUP_COUNT);
+
+    start = now_ns();
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < LOOKUP_COUNT; ++i) sum += feather_get_header(&req.headers, names[i]).len;
+    }
+    double name_ns = (now_ns() - start) / (ROUNDS * LOOKUP_COUNT);
+
+    start = now_ns();
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < LOOKUP_COUNT - 1; ++i) sum += feather_get_header_id(&req.headers, lookups[i].id).len;
+    }
+    double id_ns = (now_ns() - start) / (ROUNDS * (LOOKUP_COUNT - 1));
+
+    printf("%14s %10s %10s\n", "lookup", "ns", "speedup");
+    printf("%14s %10.1f %9.1fx\n", "linear", legacy_ns, 1.0);
+    printf("%14s %10.1f %9.1fx\n", "by name", name_ns, legacy_ns / name_ns);
+    printf("%14s %10.1f %9.1fx\n", "by id", id_ns, legacy_ns / id_ns);
+    if (sum == 0) printf("\n");
+
+    darr_deinit(&req.headers.other);
+    return 0;
+}
@@ -0,0 +1,519 @@
+#include "../src/platform/linux/coro.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Load generator for bench/server.c over loopback, on the same coroutine runtime.
+// Closed-loop scenarios keep every connection busy; the open-loop one sends on a
+// fixed schedule and times each request from when it was due, so a stalled server
+// shows up as latency instead of as fewer requests.
+
+#define RECV_TIMEOUT_MS 5000
+#define BUF_SIZE (64 * 1024)
+
+// HDR-style: 64 linear buckets per power of two of nanoseconds, so a bucket is never
+// wider than 1/64 of its values. Anything past 2^40 ns (~18 minutes) lands in the last.
+#define SUB_BITS 6
+#define SUB (1 << SUB_BITS)
+#define HIST_MAX_EXP 40
+#define HIST_BUCKETS ((HIST_MAX_EXP - SUB_BITS + 2) * SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+} Histogram;
+
+typedef struct {
+    const char *name;
+    int open_loop;
+    // A new connection for every request, with Connection: close
+    int close;
+    // Requests written together per round trip
+    int pipeline;
+    // Bytes POSTed to /upload
+    size_t body;
+    // GETs spread over this many of bench/server.c's parameterized routes
+    int routes;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    { .name = "keepalive", .pipeline = 1 },
+    { .name = "close", .close = 1, .pipeline = 1 },
+    { .name = "pipelined", .pipeline = 16 },
+    { .name = "post_256k", .pipeline = 1, .body = 256 * 1024 },
+    { .name = "routes", .pipeline = 1, .routes = 256 },
+    { .name = "keepalive_open", .open_loop = 1, .pipeline = 1 },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct {
+    const Scenario *sc;
+    int port;
+    int connections;
+
+    // Prebuilt requests; `routes` scenarios format theirs per request instead
+    char *wire;
+    size_t wire_len;
+
+    uint64_t start_ns;
+    uint64_t record_ns;  // after the warmup
+    uint64_t end_ns;
+    double interval_ns;  // open loop: between one connection's requests
+
+    Histogram hist;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t next_route;
+} Run;
+
+typedef struct {
+    Run *run;
+    int index;
+} Client;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static size_t hist_index(uint64_t v) {
+    if (v < 2 * SUB) return (size_t) v;
+    int e = 63 - __builtin_clzll(v) - SUB_BITS;
+    size_t index = (size_t) e * SUB + (size_t) (v >> e);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// The middle of the bucket
+static uint64_t hist_value(size_t index) {
+    if (index < 2 * SUB) return index;
+    int e = (int) (index / SUB) - 1;
+    uint64_t m = index - (size_t) e * SUB;
+    return (m << e) + ((1ULL << e) >> 1);
+}
+
+static void hist_record(Histogram *h, uint64_t v, uint64_t count) {
+    h->counts[hist_index(v)] += count;
+    h->total += count;
+    h->sum += (double) v * (double) count;
+    if (v > h->max) h->max = v;
+}
+
+static uint64_t hist_percentile(const Histogram *h, double q) {
+    uint64_t target = (uint64_t) (q * (double) h->total + 0.5);
+    if (target == 0) target = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->counts[i];
+        if (seen >= target) return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+// A closed-loop client can't send while it waits, so one slow response hides the
+// requests that would have been issued meanwhile. Like HdrHistogram's correction, every
+// value longer than the expected interval adds the samples those requests would have
+// seen: value - interval, value - 2 * interval and so on.
+static void hist_corrected(const Histogram *raw, uint64_t interval, Histogram *out) {
+    *out = *raw;
+    if (interval == 0) return;
+
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        if (!raw->counts[i]) continue;
+
+        uint64_t v = hist_value(i);
+        for (uint64_t missing = v > interval ? v - interval : 0; missing >= interval; missing -= interval) {
+            hist_record(out, missing, raw->counts[i]);
+        }
+    }
+}
+
+static int dial(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t) port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (errno != EINPROGRESS
+            || coro_sleep_fd_timeout(fd, EPOLLOUT, RECV_TIMEOUT_MS) <= 0
+            || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0
+            || err != 0) {
+            coro_close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = coro_send(fd, data, len, 0, RECV_TIMEOUT_MS);
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static const char *find_head_end(const char *buf, size_t len) {
+    for (size_t i = 3; i < len; ++i) {
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r') return buf + i + 1;
+    }
+    return NULL;
+}
+
+// Reads one response off `fd`, keeping whatever follows it in `buf`. Returns its status,
+// or -1 if the connection failed or the response isn't framed by a Content-Length.
+static int read_response(int fd, char *buf, size_t *len, int *closing) {
+    const char *end;
+    while (!(end = find_head_end(buf, *len))) {
+        if (*len == BUF_SIZE) return -1;
+        ssize_t n = coro_recv(fd, buf + *len, BUF_SIZE - *len, RECV_TIMEOUT_MS);
+        if (n <= 0) return -1;
+        *len += (size_t) n;
+    }
+
+    if (*len < 12 || memcmp(buf, "HTTP/1.", 7) != 0) return -1;
+    int status = atoi(buf + 9);
+
+    long content_length = -1;
+    for (const char *line = memchr(buf, '\n', (size_t) (end - buf)) + 1; line < end - 2; ) {
+        const char *eol = memchr(line, '\n', (size_t) (end - line));
+        if (strncasecmp(line, "Content-Length:", 15) == 0) content_length = atol(line + 15);
+        if (strncasecmp(line, "Connection: close", 17) == 0) *closing = 1;
+        line = eol + 1;
+    }
+    if (content_length < 0) return -1;
+
+    size_t total = (size_t) (end - buf) + (size_t) content_length;
+
+    // Only the framing matters, so a body bigger than the buffer is read and dropped
+    if (total > BUF_SIZE) {
+        for (size_t left = total - *len; left > 0; ) {
+            ssize_t n = coro_recv(fd, buf, left < BUF_SIZE ? left : BUF_SIZE, RECV_TIMEOUT_MS);
+            if (n <= 0) return -1;
+            left -= (size_t) n;
+        }
+        *len = 0;
+        return status;
+    }
+
+    while (*len < total) {
+        ssize_t n = coro_recv(fd, buf + *len, BUF_SIZE - *len, RECV_TIMEOUT_MS);
+        if (n <= 0) return -1;
+        *len += (size_t) n;
+    }
+
+    memmove(buf, buf + total, *len - total);
+    *len -= total;
+
+    return status;
+}
+
+static void client(void *arg) {
+    Client *self = arg;
+    Run *run = self->run;
+    const Scenario *sc = run->sc;
+
+    char *buf = malloc(BUF_SIZE);
+    size_t len = 0;
+    int fd = -1;
+    char route_wire[128];
+
+    // Open-loop connections start spread over one interval
+    uint64_t offset = (uint64_t) (run->interval_ns * self->index / run->connections);
+
+    for (uint64_t k = 0; ; ++k) {
+        uint64_t now = now_ns();
+        uint64_t due = now;
+
+        if (sc->open_loop) {
+            due = run->start_ns + offset + (uint64_t) (run->interval_ns * (double) k);
+            if (due >= run->end_ns) break;
+            // The wheel ticks in milliseconds; whatever is left of a millisecond is sent
+            // early and timed from when it actually went out
+            if (due > now + 1000000) coro_sleep_ms((int) ((due - now) / 1000000));
+        } else if (now >= run->end_ns) {
+            break;
+        }
+
+        if (fd < 0 && (fd = dial(run->port)) < 0) {
+            run->errors += 1;
+            coro_sleep_ms(1);
+            continue;
+        }
+
+        const char *wire = run->wire;
+        size_t wire_len = run->wire_len;
+        if (sc->routes) {
+            int route = (int) (run->next_route++ % (uint64_t) sc->routes);
+            wire = route_wire;
+            wire_len = (size_t) snprintf(route_wire, sizeof(route_wire),
+                "GET /api/v1/r%d/%lu/items HTTP/1.1\r\nHost: bench\r\n\r\n", route, (unsigned long) k);
+        }
+
+        uint64_t sent = now_ns();
+        int closing = sc->close;
+        int failed = send_all(fd, wire, wire_len) < 0;
+
+        for (int i = 0; i < sc->pipeline && !failed; ++i) {
+            int status = read_response(fd, buf, &len, &closing);
+            uint64_t done = now_ns();
+
+            if (status != 200) {
+                failed = 1;
+                break;
+            }
+
+            if (sent >= run->record_ns && done <= run->end_ns) {
+                hist_record(&run->hist, done - (due < sent ? due : sent), 1);
+                run->requests += 1;
+            }
+        }
+
+        if (failed) run->errors += 1;
+        if (failed || closing) {
+            coro_close(fd);
+            fd = -1;
+            len = 0;
+        }
+    }
+
+    if (fd >= 0) coro_close(fd);
+    free(buf);
+}
+
+static void build_wire(Run *run) {
+    const Scenario *sc = run->sc;
+    if (sc->routes) return;
+
+    char head[256];
+    int head_len;
+    if (sc->body) {
+        head_len = snprintf(head, sizeof(head), "POST /upload HTTP/1.1\r\nHost: bench\r\nContent-Length: %zu\r\n\r\n", sc->body);
+    } else {
+        head_len = snprintf(head, sizeof(head), "GET / HTTP/1.1\r\nHost: bench\r\n%s\r\n", sc->close ? "Connection: close\r\n" : "");
+    }
+
+    size_t one = (size_t) head_len + sc->body;
+    run->wire_len = one * (size_t) sc->pipeline;
+    run->wire = calloc(1, run->wire_len);
+    for (int i = 0; i < sc->pipeline; ++i) {
+        memcpy(run->wire + one * (size_t) i, head, (size_t) head_len);
+    }
+}
+
+typedef struct {
+    double p50, p90, p99, p999, max, mean;
+} Summary;
+
+static Summary summarize(const Histogram *h) {
+    Summary s = {0};
+    if (h->total == 0) return s;
+
+    s.p50 = hist_percentile(h, 0.50) / 1000.0;
+    s.p90 = hist_percentile(h, 0.90) / 1000.0;
+    s.p99 = hist_percentile(h, 0.99) / 1000.0;
+    s.p999 = hist_percentile(h, 0.999) / 1000.0;
+    s.max = h->max / 1000.0;
+    s.mean = h->sum / (double) h->total / 1000.0;
+    return s;
+}
+
+static void json_summary(FILE *out, const char *key, Summary s) {
+    fprintf(out, "\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}",
+        key, s.p50, s.p90, s.p99, s.p999, s.max, s.mean);
+}
+
+static pid_t spawn_server(const char *path, int port) {
+    char port_arg[16];
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        execl(path, path, port_arg, (char *) NULL);
+        perror(path);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+static int wait_for_server(int port) {
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t) port) };
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int ok = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+        close(fd);
+        if (ok) return 0;
+
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 10 * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    return -1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "usage: %s [-s server] [-p port] [-d seconds] [-c connections] [-r rate] [-f filter] [-o out.json] [-l label]\n"
+        "  -s  spawn this server binary on the port and stop it afterwards; without it an\n"
+        "      already running server is used\n"
+        "  -r  requests per second for open-loop scenarios; by default half of what the\n"
+        "      closed-loop keepalive scenario reached, or 10000 if it didn't run\n"
+        "  -f  only run scenarios whose name contains this\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *server = NULL, *out_path = NULL, *label = "", *filter = NULL;
+    int port = 6970, connections = 32;
+    double duration = 3, rate = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:d:c:r:f:o:l:h")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'l': label = optarg; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (connections < 1 || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    // Sockets here are nonblocking, which is what the epoll backend expects
+    coro_set_backend(CORO_BACKEND_EPOLL);
+
+    pid_t pid = server ? spawn_server(server, port) : 0;
+    if (wait_for_server(port) < 0) {
+        fprintf(stderr, "nothing is listening on port %d\n", port);
+        if (pid) kill(pid, SIGTERM);
+        return 1;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : NULL;
+    if (out_path && !out) {
+        perror(out_path);
+        if (pid) kill(pid, SIGTERM);
+        return 1;
+    }
+
+    if (out) {
+        fprintf(out, "{\"label\":\"%s\",\"duration_s\":%g,\"connections\":%d,\"scenarios\":[", label, duration, connections);
+    }
+
+    printf("%-16s %6s %10s %10s %10s %10s %10s %8s\n", "scenario", "mode", "rps", "p50 us", "p99 us", "p999 us", "max us", "errors");
+
+    double keepalive_rps = 0;
+    int written = 0;
+    Client *clients = calloc((size_t) connections, sizeof(Client));
+
+    for (size_t s = 0; s < SCENARIO_COUNT; ++s) {
+        const Scenario *sc = &scenarios[s];
+        if (filter && !strstr(sc->name, filter)) continue;
+
+        Run *run = calloc(1, sizeof(Run));
+        run->sc = sc;
+        run->port = port;
+        run->connections = connections;
+        build_wire(run);
+
+        double target = rate > 0 ? rate : keepalive_rps > 0 ? keepalive_rps / 2 : 10000;
+        if (sc->open_loop) run->interval_ns = 1e9 * connections / target;
+
+        // The first tenth warms up connections, caches and the server's pools
+        run->start_ns = now_ns();
+        run->record_ns = run->start_ns + (uint64_t) (duration * 1e8);
+        run->end_ns = run->start_ns + (uint64_t) (duration * 1e9);
+
+        for (int i = 0; i < connections; ++i) {
+            clients[i] = (Client) { .run = run, .index = i };
+            coro_spawn(client, &clients[i]);
+        }
+        coro_start();
+
+        double seconds = (run->end_ns - run->record_ns) / 1e9;
+        double rps = run->requests / seconds;
+        if (!sc->open_loop && strcmp(sc->name, "keepalive") == 0) keepalive_rps = rps;
+
+        // Open-loop latencies are timed from when each request was due and need no correction.
+        // Closed-loop connections are expected to send once per mean latency.
+        Histogram *corrected = malloc(sizeof(Histogram));
+        uint64_t interval = sc->open_loop || !run->hist.total ? 0 : (uint64_t) (run->hist.sum / (double) run->hist.total);
+        hist_corrected(&run->hist, interval, corrected);
+
+        Summary raw = summarize(&run->hist);
+        Summary fixed = summarize(corrected);
+
+        printf("%-16s %6s %10.0f %10.1f %10.1f %10.1f %10.1f %8lu\n",
+            sc->name, sc->open_loop ? "open" : "closed", rps, fixed.p50, fixed.p99, fixed.p999, fixed.max, (unsigned long) run->errors);
+
+        if (out) {
+            fprintf(out, "%s\n{\"name\":\"%s\",\"mode\":\"%s\",\"pipeline\":%d,\"body_bytes\":%zu,\"routes\":%d,",
+                written++ ? "," : "", sc->name, sc->open_loop ? "open" : "closed", sc->pipeline, sc->body, sc->routes);
+            if (sc->open_loop) fprintf(out, "\"target_rps\":%.0f,", target);
+            fprintf(out, "\"requests\":%lu,\"errors\":%lu,\"rps\":%.1f,", (unsigned long) run->requests, (unsigned long) run->errors, rps);
+            json_summary(out, "latency_us", raw);
+            fputc(',', out);
+            json_summary(out, "corrected_latency_us", fixed);
+            fputc('}', out);
+        }
+
+        free(corrected);
+        free(run->wire);
+        free(run);
+    }
+
+    if (out) {
+        fprintf(out, "\n]}\n");
+        fclose(out);
+    }
+
+    free(clients);
+
+    if (pid) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "feather.h"
+#include "strview.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Bursts small enough to fit a thread's ring, with a pause after each for the writer
+// to drain it, so what's timed is logging and not dropping
+#define BURSTS 200
+#define BURST 2000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static FILE *legacy_out;
+
+// How feather_log wrote before: a clock read, localtime and three printfs on the caller
+static void legacy_log(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    time_t t = time(NULL);
+    struct tm *tm = localtime(&t);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
+
+    fprintf(legacy_out, "[%s] ", buf);
+    vfprintf(legacy_out, fmt, args);
+    fprintf(legacy_out, "\n");
+
+    va_end(args);
+}
+
+static void pause_for_writer(void) {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 20 * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+int main(void) {
+    legacy_out = fopen("/dev/null", "w");
+    if (!legacy_out || feather_log_open("/dev/null") < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    FeatherRequest req = {0};
+    req.method = FEATHER_GET;
+    req.path = SV_LIT("/articles/2024/simd-parsing");
+
+    double legacy_ns = 0, message_ns = 0, request_ns = 0;
+
+    for (size_t b = 0; b < BURSTS; ++b) {
+        double start = now_ns();
+        for (size_t i = 0; i < BURST; ++i) legacy_log("GET %s %d", "/articles/2024/simd-parsing", 200);
+        legacy_ns += now_ns() - start;
+
+        start = now_ns();
+        for (size_t i = 0; i < BURST; ++i) feather_log("GET %s %d", "/articles/2024/simd-parsing", 200);
+        message_ns += now_ns() - start;
+        pause_for_writer();
+
+        start = now_ns();
+        for (size_t i = 0; i < BURST; ++i) feather_log_request(&req);
+        request_ns += now_ns() - start;
+        pause_for_writer();
+    }
+
+    legacy_ns /= BURSTS * BURST;
+    message_ns /= BURSTS * BURST;
+    request_ns /= BURSTS * BURST;
+
+    printf("%20s %10s %10s\n", "log", "ns", "speedup");
+    printf("%20s %10.1f %9.1fx\n", "printf", legacy_ns, 1.0);
+    printf("%20s %10.1f %9.1fx\n", "feather_log", message_ns, legacy_ns / message_ns);
+    printf("%20s %10.1f %9.1fx\n", "feather_log_request", request_ns, legacy_ns / request_ns);
+    printf("dropped %lu\n", (unsigned long) feather_log_dropped());
+
+    fclose(legacy_out);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "feather.h"
+#include "strview.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOOKUPS 2000000
+
+static void dummy_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    (void) req;
+    (void) ctx;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Route shapes roughly follow a REST API: static pages, resources and nested resources
+static char *make_pattern(size_t i) {
+    char *buf = malloc(64);
+    switch (i % 3) {
+        case 0: snprintf(buf, 64, "/pages/page%zu", i); break;
+        case 1: snprintf(buf, 64, "/api/v1/res%zu/:id", i); break;
+        default: snprintf(buf, 64, "/api/v1/res%zu/:id/items/:item", i); break;
+    }
+    return buf;
+}
+
+static char *make_path(size_t i) {
+    char *buf = malloc(64);
+    switch (i % 3) {
+        case 0: snprintf(buf, 64, "/pages/page%zu", i); break;
+        case 1: snprintf(buf, 64, "/api/v1/res%zu/42", i); break;
+        default: snprintf(buf, 64, "/api/v1/res%zu/42/items/7", i); break;
+    }
+    return buf;
+}
+
+static double run(const FeatherApp *app, char **paths, size_t path_count) {
+    FeatherRequest req = {0};
+    req.method = FEATHER_GET;
+    size_t found = 0;
+
+    double start = now_ns();
+    for (size_t i = 0; i < LOOKUPS; ++i) {
+        req.path = sv_from_cstr(paths[(i * 7919) % path_count]);
+        found += feather_find_handler(app, &req) != NULL;
+    }
+    double elapsed = now_ns() - start;
+
+    if (found != LOOKUPS) {
+        fprintf(stderr, "router mismatch: %zu of %d lookups matched\n", found, LOOKUPS);
+        exit(1);
+    }
+
+    return elapsed / LOOKUPS;
+}
+
+int main(void) {
+    size_t sizes[] = { 10, 100, 1000 };
+
+    printf("%8s %14s %14s %10s\n", "routes", "linear ns/op", "tree ns/op", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t n = sizes[s];
+
+        FeatherApp linear, tree;
+        feather_init_app(&linear);
+        feather_init_app(&tree);
+
+        char **paths = malloc(n * sizeof(char *));
+        for (size_t i = 0; i < n; ++i) {
+            char *pattern = make_pattern(i);
+            feather_get(&linear, pattern, dummy_handler);
+            feather_get(&tree, pattern, dummy_handler);
+            paths[i] = make_path(i);
+        }
+
+        // An unfrozen app falls back to the linear feather_match_route scan
+        feather_freeze_app(&tree);
+
+        double linear_ns = run(&linear, paths, n);
+        double tree_ns = run(&tree, paths, n);
+
+        printf("%8zu %14.1f %14.1f %9.1fx\n", n, linear_ns, tree_ns, linear_ns / tree_ns);
+    }
+
+    return 0;
+}
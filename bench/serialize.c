@@ -0,0 +1,139 @@
+#include "feather.h"
+#include "strview.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 5000000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *legacy_reason(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 500: return "Internal Server Error";
+
+        default: return "";
+    }
+}
+
+// How heads were written before: one snprintf for the status line and one per header
+static size_t legacy_dump_head(const FeatherResponse *res, char *buf, size_t buf_size) {
+    size_t offset = 0;
+
+    int n = snprintf(buf + offset, buf_size - offset, "HTTP/1.1 %d %s\r\n", res->status, legacy_reason(res->status));
+    if (n < 0 || (size_t) n >= buf_size - offset) return 0;
+    offset += (size_t) n;
+
+#define WRITE_HEADER(key, value) \
+    do { \
+        if ((value).len > 0) { \
+            n = snprintf(buf + offset, buf_size - offset, SV_FMT": "SV_FMT"\r\n", SV_ARG(key), SV_ARG(value)); \
+            if (n < 0 || (size_t) n >= buf_size - offset) return 0; \
+            offset += (size_t) n; \
+        } \
+    } while (0)
+
+    WRITE_HEADER(SV_LIT("Authorization"), res->headers.authorization);
+    WRITE_HEADER(SV_LIT("Cookie"), res->headers.cookie);
+    WRITE_HEADER(SV_LIT("Content-Type"), res->headers.content_type);
+    WRITE_HEADER(SV_LIT("Content-Length"), res->headers.content_length);
+
+    if (!res->headers.content_length.len && res->body.len > 0) {
+        n = snprintf(buf + offset, buf_size - offset, "Content-Length: %zu\r\n", res->body.len);
+        if (n < 0 || (size_t) n >= buf_size - offset) return 0;
+        offset += (size_t) n;
+    }
+
+    darr_foreach(FeatherHeader, &res->headers.other, header) {
+        WRITE_HEADER(header->key, header->value);
+    }
+#undef WRITE_HEADER
+
+    // The old head had no Date header; add the same bytes so both write as much
+    StrView date = feather_date_header();
+    n = snprintf(buf + offset, buf_size - offset, SV_FMT, SV_ARG(date));
+    if (n < 0 || (size_t) n >= buf_size - offset) return 0;
+    offset += (size_t) n;
+
+    if (offset + 2 >= buf_size) return 0;
+
+    buf[offset++] = '\r';
+    buf[offset++] = '\n';
+
+    return offset;
+}
+
+typedef struct {
+    const char *name;
+    FeatherResponse res;
+} Case;
+
+static double run(const FeatherResponse *res, size_t (*dump)(const FeatherResponse *, char *, size_t), size_t *sum) {
+    char buf[1024];
+
+    double start = now_ns();
+    for (size_t i = 0; i < ROUNDS; ++i) {
+        *sum += dump(res, buf, sizeof(buf));
+        *sum += (unsigned char) buf[i % 16];
+    }
+    return (now_ns() - start) / ROUNDS;
+}
+
+int main(void) {
+    static char body[4096];
+    memset(body, 'x', sizeof(body));
+
+    Case cases[3] = {0};
+
+    cases[0].name = "json";
+    cases[0].res.status = 200;
+    cases[0].res.body = sv_from_buf(body, 87);
+    cases[0].res.headers.content_type = SV_LIT("application/json");
+
+    cases[1].name = "page";
+    cases[1].res.status = 200;
+    cases[1].res.body = sv_from_buf(body, sizeof(body));
+    cases[1].res.headers.content_type = SV_LIT("text/html; charset=utf-8");
+    feather_set_header(&cases[1].res.headers, SV_LIT("Cache-Control"), SV_LIT("public, max-age=3600"));
+    feather_set_header(&cases[1].res.headers, SV_LIT("ETag"), SV_LIT("\"5f2a9c-1000\""));
+    feather_set_header(&cases[1].res.headers, SV_LIT("X-Request-Id"), SV_LIT("7d9f1c2e-4b7a-4c3e-9f1d-2a6b8c0e4f5a"));
+    feather_set_header(&cases[1].res.headers, SV_LIT("Set-Cookie"), SV_LIT("session=8f14e45fceea167a5a36dedd4bea2543; Path=/; HttpOnly"));
+
+    cases[2].name = "404";
+    cases[2].res.status = 404;
+    cases[2].res.body = SV_LIT("<h3>Not Found</h3>");
+    cases[2].res.headers.content_type = SV_LIT("text/html");
+
+    printf("%8s %10s %14s %14s %8s\n", "response", "head bytes", "snprintf ns", "emitters ns", "speedup");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const FeatherResponse *res = &cases[c].res;
+
+        char a[1024], b[1024];
+        size_t a_len = legacy_dump_head(res, a, sizeof(a));
+        size_t b_len = feather_dump_response_head(res, b, sizeof(b));
+        if (a_len != b_len || memcmp(a, b, a_len) != 0) {
+            fprintf(stderr, "serializer mismatch on %s response\n", cases[c].name);
+            return 1;
+        }
+
+        size_t sum = 0;
+        double legacy_ns = run(res, legacy_dump_head, &sum);
+        double emit_ns = run(res, feather_dump_response_head, &sum);
+
+        printf("%8s %10zu %14.1f %14.1f %7.1fx\n", cases[c].name, b_len, legacy_ns, emit_ns, legacy_ns / emit_ns);
+        if (sum == 0) printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "feather.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// What bench/load.c drives: a plain text route, a streamed upload and a few
+// hundred parameterized routes for the router to pick from
+
+#define ROUTES 256
+
+static void text_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    (void) req;
+    FeatherResponse res = {0};
+    res.status = 200;
+    res.headers.content_type = SV_LIT("text/plain");
+    res.body = SV_LIT("Hello, World!");
+    feather_response_send(ctx, &res);
+}
+
+static void upload_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    (void) req;
+    char chunk[16384];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = feather_request_read(ctx, chunk, sizeof(chunk))) > 0) total += (size_t) n;
+
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+    res.status = n < 0 ? 400 : 200;
+    res.body = feather_sprintf(ctx, "%zu", total);
+    feather_response_send(ctx, &res);
+}
+
+static void item_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+    res.status = 200;
+    res.headers.content_type = SV_LIT("application/json");
+    res.body = feather_sprintf(ctx, "{\"id\":\"%.*s\"}", SV_ARG(req->params[0].value));
+    feather_response_send(ctx, &res);
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 6970;
+
+    FeatherApp app;
+    feather_init_app(&app);
+    feather_get(&app, "/", text_handler);
+    feather_add_route_opts(&app, FEATHER_POST, "/upload", upload_handler, (FeatherRouteOptions) { .stream_body = 1, .max_body = 64 << 20 });
+
+    static char patterns[ROUTES][64];
+    for (int i = 0; i < ROUTES; ++i) {
+        snprintf(patterns[i], sizeof(patterns[i]), "/api/v1/r%d/:id/items", i);
+        feather_get(&app, patterns[i], item_handler);
+    }
+
+    return feather_run(&app, port);
+}
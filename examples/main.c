@@ -24,30 +24,6 @@ void home_handler(const FeatherRequest *req, FeatherCtx *ctx) {
     feather_response_send(ctx, &res);
 }
 
-void home_styles_handler(const FeatherRequest *req, FeatherCtx *ctx) {
-    (void) req;
-
-    FeatherResponse res = {0};
-    res.status = 200;
-    res.body = SV_LIT(
-        "body {"
-            "background-color: #000;"
-            "color: #fff;"
-        "}"
-        ".title {"
-            "text-align: center;"
-            "font-size: 32px;"
-        "}"
-        ".subtitle {"
-            "text-align: center;"
-            "margin-top: 8px;"
-            "font-size: 24px;"
-        "}"
-    );
-
-    feather_response_send(ctx, &res);
-}
-
 void about_handler(const FeatherRequest *req, FeatherCtx *ctx) {
     (void) req;
 
@@ -60,12 +36,15 @@ void about_handler(const FeatherRequest *req, FeatherCtx *ctx) {
 }
 
 void user_handler(const FeatherRequest *req, FeatherCtx *ctx) {
-    char body[256];
-    FeatherResponse res = {0};
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+
+    // /user/bob?greeting=Good+morning
+    StrView greeting = feather_query_get(req, "greeting");
+    if (!greeting.ptr) greeting = SV_LIT("Hello");
 
-    snprintf(body, sizeof(body) - 1, "<h1>Hello, "SV_FMT"</h1>", SV_ARG(req->params[0].value));
     res.status = 200;
-    res.body = sv_from_cstr(body);
+    res.body = feather_sprintf(ctx, "<h1>"SV_FMT", "SV_FMT"</h1>", SV_ARG(greeting), SV_ARG(req->params[0].value));
     res.headers.content_type = SV_LIT("text/html");
 
     feather_response_send(ctx, &res);
@@ -86,12 +65,19 @@ int main() {
     FeatherApp app;
     feather_init_app(&app);
 
-    feather_get(&app, "/home", home_handler);
-    feather_get(&app, "/styles.css", home_styles_handler);
+    // The page never changes, so it's answered from the response cache after the first time
+    feather_add_route_opts(&app, FEATHER_GET, "/home", home_handler, (FeatherRouteOptions) {
+        .cache_ttl_ms = 60 * 1000,
+        .cache_compress = 1,
+    });
     feather_get(&app, "/about", about_handler);
     feather_get(&app, "/user/:id", user_handler);
     feather_post(&app, "/user", new_user_handler);
 
+    // Anything no route claims is looked up under examples/public, e.g. /styles.css
+    feather_static(&app, "/", "examples/public");
+    feather_metrics(&app, "/metrics");
+
     int res = feather_run(&app, 6969);
 
     if (res != 0) {
@@ -39,6 +39,8 @@
       (arr)->deinit_item((arr)->items + i); \
     } \
   free((arr)->items); \
+  (arr)->items = NULL; \
+  (arr)->size = (arr)->cap = 0; \
 } while (0) \
 
 #define darr_pop(arr) do { \
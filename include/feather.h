@@ -1,18 +1,17 @@
 #ifndef __FEATHER_H__
 #define __FEATHER_H__
 
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 #include "strview.h"
 #include "dyn_arr.h"
+#include "feather_headers.h"
 
 #define __FEATHER_MAX_PARAMS 16
 
-#ifdef FEATHER_LOG
-    #define FEATHER_LOG_REQUEST(req) feather_log_request(req)
-#else
-    #define FEATHER_LOG_REQUEST(req) ((void)0)
-#endif
-
 typedef enum {
     FEATHER_GET,
     FEATHER_POST,
@@ -24,11 +23,45 @@ typedef enum {
     FEATHER_UNKNOWN
 } FeatherMethod;
 
+typedef enum {
+    FEATHER_BACKEND_AUTO,
+    FEATHER_BACKEND_EPOLL,
+    FEATHER_BACKEND_URING,
+} FeatherBackend;
+
 typedef struct {
     StrView key;
     StrView value;
+    FeatherHeaderId id;
 } FeatherHeader;
 
+// Bump allocator for memory that lives as long as one request. Starts in a
+// caller-provided block and chains heap blocks once that is full; reset rewinds
+// it while keeping those blocks around for the next request.
+#define FEATHER_ARENA_BLOCK_SIZE (1024 * 8)
+#define FEATHER_ARENA_ALIGN 16
+
+typedef struct FeatherArenaBlock FeatherArenaBlock;
+
+typedef struct {
+    char *ptr;
+    size_t used;
+    size_t cap;
+
+    char *initial;
+    size_t initial_cap;
+    FeatherArenaBlock *blocks;
+    FeatherArenaBlock *current;
+} FeatherArena;
+
+void feather_arena_init(FeatherArena *arena, void *initial, size_t size);
+void *feather_arena_alloc(FeatherArena *arena, size_t size);
+// The result is also NUL-terminated
+StrView feather_arena_sprintf(FeatherArena *arena, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+StrView feather_arena_vsprintf(FeatherArena *arena, const char *fmt, va_list args);
+void feather_arena_reset(FeatherArena *arena);
+void feather_arena_deinit(FeatherArena *arena);
+
 typedef struct {
     StrView authorization;
     StrView cookie;
@@ -37,6 +70,10 @@ typedef struct {
     StrView connection;
 
     DynArr(FeatherHeader) other;
+    // When set, `other` grows inside it instead of on the heap
+    FeatherArena *arena;
+    // 1-based position in `other` of each standard header that's set, 0 if it isn't
+    uint16_t index[FEATHER_HEADER_COUNT];
 } FeatherHeaders;
 
 typedef struct {
@@ -44,13 +81,31 @@ typedef struct {
     StrView value;
 } FeatherParam;
 
+// Query or cookie pairs, decoded the first time one of them is asked for
+typedef struct {
+    FeatherParam *items;
+    size_t count;
+    int parsed;
+} FeatherPairIndex;
+
+typedef struct {
+    FeatherPairIndex query;
+    FeatherPairIndex cookies;
+} FeatherRequestIndex;
+
 typedef struct {
     FeatherMethod method;
-    StrView path;
+    StrView path;       // without the query
+    StrView query;      // after the '?', still percent-encoded
     FeatherParam params[__FEATHER_MAX_PARAMS];
     size_t param_count;
     FeatherHeaders headers;
     StrView body;
+
+    // Set by the server for feather_query_get and feather_cookie_get, which decode
+    // into `arena` and keep what they parsed in `index`
+    FeatherArena *arena;
+    FeatherRequestIndex *index;
 } FeatherRequest;
 
 typedef struct {
@@ -65,16 +120,69 @@ typedef void (*FeatherHandler)(const FeatherRequest *req, FeatherCtx *ctx);
 
 typedef enum { FEATHER_ROUTE_STATIC, FEATHER_ROUTE_REGEX } FeatherRouteType;
 
+// Per-route settings; a zeroed struct gives the defaults feather_add_route uses
+typedef struct {
+    // With work stealing on, the handler may be resumed on another worker after it
+    // blocks. Leave unset for handlers that keep state in thread-locals.
+    int migratable;
+
+    // The handler pulls the body itself with feather_request_read instead of finding
+    // it in req->body, so it needn't fit in the connection buffer
+    int stream_body;
+    // Larger bodies are refused with 413; 0 leaves only the buffer's own limit
+    size_t max_body;
+
+    // Keeps 200 responses for this long (0 leaves caching off) and answers later
+    // requests with the same method, path, query and `cache_vary` header values
+    // from memory, without calling the handler
+    int cache_ttl_ms;
+    const char *const *cache_vary;  // NULL-terminated header names
+    // Also keeps gzip and deflate copies, picked by Accept-Encoding
+    int cache_compress;
+} FeatherRouteOptions;
+
+// Files under `root` served at `prefix` for GET and HEAD requests no route matched
+typedef struct {
+    StrView prefix;     // without a trailing '/'
+    StrView root;
+} FeatherStaticMount;
+
 typedef struct {
     FeatherRouteType type;
     StrView pattern;
     FeatherMethod method;
     FeatherHandler handler;
+    FeatherRouteOptions options;
+
+    // Filled in by feather_freeze_app, in the order the params appear in the pattern
+    StrView *param_keys;
+    size_t param_count;
 } FeatherRoute;
 
+#define FEATHER_NO_NODE UINT32_MAX
+#define FEATHER_NO_ROUTE UINT32_MAX
+
+// One path segment of the compiled router. Static children of a node are stored
+// contiguously in FeatherApp.nodes and sorted, so a lookup is a binary search per segment.
+typedef struct {
+    StrView segment;
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t param_child;
+    uint32_t route;
+} FeatherRouteNode;
+
 typedef struct {
     FeatherRoute *routes;
     size_t route_count;
+
+    FeatherRouteNode *nodes;
+    size_t node_count;
+    uint32_t roots[FEATHER_UNKNOWN + 1];
+    int frozen;
+
+    FeatherStaticMount *mounts;
+    size_t mount_count;
 } FeatherApp;
 
 const char *feather_method_to_str(FeatherMethod method);
@@ -82,27 +190,187 @@ FeatherMethod feather_sv_to_method(StrView sv);
 
 void feather_parse_request(FeatherRequest *req, StrView raw);
 
+// Heads with more lines than this are flagged as truncated by the scanner
+#define FEATHER_MAX_HEADER_LINES 128
+#define FEATHER_NO_COLON UINT32_MAX
+
+typedef struct {
+    uint32_t start;
+    uint32_t len;       // without the line terminator
+    uint32_t colon;     // of the first ':', relative to start
+} FeatherLine;
+
+// Single pass over the request head that records where each line starts and ends
+// and where its first colon is, 16 or 32 bytes at a time with SSE2/AVX2. It can be
+// fed a buffer that is still filling up; each call only looks at the new bytes.
+typedef struct {
+    FeatherLine lines[FEATHER_MAX_HEADER_LINES];
+    size_t line_count;
+    size_t pos;
+    size_t line_start;
+    uint32_t colon;
+    size_t header_end;  // offset just past the blank line, 0 until it's found
+    int truncated;      // lines past FEATHER_MAX_HEADER_LINES were dropped
+} FeatherScan;
+
+void feather_scan_reset(FeatherScan *scan);
+// Returns 1 once the blank line that ends the head is in `buf`
+int feather_scan_request(FeatherScan *scan, const char *buf, size_t len);
+// Fills method, path and headers from a completed scan of `buf`. Returns 0 if the
+// head has no request line with a method and a target.
+int feather_parse_scanned(FeatherRequest *req, const char *buf, const FeatherScan *scan);
+
 size_t feather_dump_response(const FeatherResponse *response, char *buf, size_t buf_size);
+// Status line and headers only, up to and including the blank line. Like
+// feather_dump_response, returns 0 if they don't fit.
+size_t feather_dump_response_head(const FeatherResponse *response, char *buf, size_t buf_size);
+// The head without the Date header and the blank line, for responses that are
+// stored and get both added whenever they're sent
+size_t feather_dump_response_fields(const FeatherResponse *response, char *buf, size_t buf_size);
+
+// The calling thread's "Date: ...\r\n" line. Workers refresh theirs every second
+// through feather_update_date; other threads keep the time of their first call.
+StrView feather_date_header(void);
+void feather_update_date(time_t now);
 void feather_response_remove_header(FeatherResponse *res, StrView key);
 void feather_set_header(FeatherHeaders *headers, StrView key, StrView value);
+void feather_headers_deinit(FeatherHeaders *headers);
 
 StrView feather_get_header(const FeatherHeaders* headers, StrView header);
+// FEATHER_HEADER_OTHER for names outside the standard set
+FeatherHeaderId feather_header_id(StrView name);
+// Constant time, without comparing names
+StrView feather_get_header_id(const FeatherHeaders *headers, FeatherHeaderId id);
 
 void feather_init_app(FeatherApp *app);
 void feather_add_route(FeatherApp *app, FeatherMethod method, const char *path, FeatherHandler handler);
+void feather_add_route_opts(FeatherApp *app, FeatherMethod method, const char *path, FeatherHandler handler, FeatherRouteOptions options);
+void feather_freeze_app(FeatherApp *app);
 
 #define feather_get(app, path, handler) feather_add_route(app, FEATHER_GET, path, handler)
 #define feather_post(app, path, handler) feather_add_route(app, FEATHER_POST, path, handler)
 
+// Serves the files under `root` at `prefix`, e.g. feather_static(app, "/assets", "/srv/assets").
+// Bodies go out with sendfile; Range, If-None-Match and If-Modified-Since are honoured.
+void feather_static(FeatherApp *app, const char *prefix, const char *root);
+// The mount a GET or HEAD request falls under, with `rel` set to the path below its prefix
+const FeatherStaticMount *feather_find_static(const FeatherApp *app, const FeatherRequest *req, StrView *rel);
+// Joins the mount's root with the percent-decoded `rel` into `out`, falling back to
+// index.html for directories. Returns 0 if `rel` escapes the root or `out` is too small.
+size_t feather_static_path(const FeatherStaticMount *mount, StrView rel, char *out, size_t cap);
+
+// Percent-decoded value of the first query parameter or cookie called `name`, with
+// a NULL ptr if there's none. The first call parses them all; later ones only look
+// them up. Requests without an arena get the values as they were sent.
+StrView feather_query_get(const FeatherRequest *req, const char *name);
+StrView feather_cookie_get(const FeatherRequest *req, const char *name);
+
+// Response cache shared by all workers, see FeatherRouteOptions.cache_ttl_ms. Entries
+// hold the serialized response, head and all; least recently used go past the budget.
+#define FEATHER_CACHE_DEFAULT_BUDGET (1024 * 1024 * 64)
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    size_t bytes;
+    size_t entries;
+} FeatherCacheStats;
+
+typedef struct FeatherCacheEntry FeatherCacheEntry;
+
+// Returns the entry for the request, held until feather_cache_release, and points
+// `head` and `rest` at the variant it accepts: the status line and headers, then
+// the blank line and body. The current Date header goes between them. NULL on a miss.
+FeatherCacheEntry *feather_cache_lookup(const FeatherRoute *route, const FeatherRequest *req, StrView *head, StrView *rest);
+// Stores `res` as the answer to `req`, same return as feather_cache_lookup. NULL if
+// the response can't be cached, e.g. because it isn't a 200.
+FeatherCacheEntry *feather_cache_store(const FeatherRoute *route, const FeatherRequest *req, const FeatherResponse *res, StrView *head, StrView *rest);
+void feather_cache_release(FeatherCacheEntry *entry);
+void feather_set_cache_budget(size_t bytes);
+void feather_cache_stats(FeatherCacheStats *stats);
+
+const FeatherRoute *feather_find_route(const FeatherApp *app, FeatherRequest *req);
 FeatherHandler feather_find_handler(const FeatherApp *app, FeatherRequest *req);
+int feather_match_route(StrView pattern, FeatherRequest *req);
 
-void feather_log(const char *fmt, ...);
+// Logging never blocks the caller: records go into a ring owned by the calling thread
+// and a writer thread formats and writes them. When a ring is full the record is
+// dropped and counted.
+void feather_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void feather_log_request(const FeatherRequest *req);
+// Sends the log to the file at `path`, appending, or back to stdout for NULL. -1 and errno if it can't be opened.
+int feather_log_open(const char *path);
+uint64_t feather_log_dropped(void);
+
+// How feather_run_config sets up its workers; zeroed fields keep feather_run's defaults
+typedef struct {
+    int port;
+    // 0 starts one per CPU the process may run on, or one per entry of `cpus` if it's set
+    int workers;
+
+    // Pins worker i to cpus[i], or to the i-th CPU the process may run on when `cpus` is NULL.
+    // `cpus` holds `cpu_count` entries, at least one per worker; feather_run_config exits
+    // with an error otherwise.
+    int pin_workers;
+    const int *cpus;
+    int cpu_count;
+
+    // Hands each connection to the worker pinned to the CPU its packets arrived on,
+    // through a SO_ATTACH_REUSEPORT_CBPF program, so it's served where the NIC queue's
+    // interrupts already warmed the caches. Implies pin_workers.
+    int steer_by_cpu;
+
+    // Logs a line for every response to this file, or to stdout for "-"
+    const char *access_log;
+} FeatherRunConfig;
 
 // Platform-dependent funcs
 int feather_run(FeatherApp *app, int port);
+int feather_run_config(FeatherApp *app, const FeatherRunConfig *config);
+// Serves counters, per-route latency histograms and scheduler gauges at `path` in the
+// Prometheus text format. Recording is always on; this only adds the route.
+void feather_metrics(FeatherApp *app, const char *path);
+
+// Records a span per phase (recv, parse, route, body, handler, send) and per coroutine
+// park for about `rate` of requests, 0 to 1; 0, the default, turns tracing off. Each
+// worker keeps its latest 16384 spans.
+void feather_trace_sample(double rate);
+// Writes the buffered spans as Chrome trace-event JSON, for chrome://tracing or Perfetto
+int feather_trace_dump(const char *path);
+// Serves the same JSON at `path`
+void feather_trace(FeatherApp *app, const char *path);
 void feather_response_send(FeatherCtx *ctx, FeatherResponse *res);
+// Zeroes `res` and backs its extra headers with the request's arena
+void feather_response_init(FeatherCtx *ctx, FeatherResponse *res);
+// Memory from the request's arena, valid until the response has been sent
+void *feather_alloc(FeatherCtx *ctx, size_t size);
+StrView feather_sprintf(FeatherCtx *ctx, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Streams a body of unknown length with chunked transfer-encoding: begin sends the
+// status line and headers (res->body is ignored), each write_chunk sends one chunk
+// and parks the handler while the client isn't keeping up, end terminates the body.
+// write_chunk returns -1 once the connection failed; end must still be called.
+void feather_response_begin(FeatherCtx *ctx, FeatherResponse *res);
+int feather_response_write_chunk(FeatherCtx *ctx, StrView data);
+void feather_response_end(FeatherCtx *ctx);
+// For stream_body routes: reads up to `n` bytes of the request body, with chunked
+// transfer-encoding already decoded. Returns 0 at the end of the body and -1 on
+// error, with errno EMSGSIZE once it exceeds the route's max_body.
+ssize_t feather_request_read(FeatherCtx *ctx, void *buf, size_t n);
 void feather_sleep_fd(int fd, int events);
+// Returns 1 once the fd is ready, 0 if `ms` passed first, and -1 with errno set on error
+int feather_sleep_fd_timeout(int fd, int events, int ms);
 void feather_sleep_ms(int ms);
+// Size of each connection's coroutine stack, at least 32 KiB. The connection loop
+// itself takes about 16 KiB of it and handlers get the rest. Pages are committed
+// lazily, so this bounds the deepest handler rather than the memory every connection costs.
+void feather_set_stack_size(size_t size);
+// I/O backend for the workers, to be set before feather_run. AUTO prefers io_uring;
+// any worker that can't set up a ring runs on epoll instead.
+void feather_set_backend(FeatherBackend backend);
+// Lets idle workers take runnable connections off busy ones, to be set before
+// feather_run. Connections only move between requests or inside migratable routes.
+void feather_set_work_stealing(int enabled);
 
 #endif // __FEATHER_H__
@@ -0,0 +1,88 @@
+// Generated by tools/gen_headers.py, do not edit
+
+#ifndef __FEATHER_HEADERS_H__
+#define __FEATHER_HEADERS_H__
+
+// Standard header names, interned when a header is set
+typedef enum {
+    FEATHER_HEADER_OTHER,
+    FEATHER_HEADER_ACCEPT,
+    FEATHER_HEADER_ACCEPT_CHARSET,
+    FEATHER_HEADER_ACCEPT_ENCODING,
+    FEATHER_HEADER_ACCEPT_LANGUAGE,
+    FEATHER_HEADER_ACCEPT_RANGES,
+    FEATHER_HEADER_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+    FEATHER_HEADER_ACCESS_CONTROL_ALLOW_HEADERS,
+    FEATHER_HEADER_ACCESS_CONTROL_ALLOW_METHODS,
+    FEATHER_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN,
+    FEATHER_HEADER_ACCESS_CONTROL_EXPOSE_HEADERS,
+    FEATHER_HEADER_ACCESS_CONTROL_MAX_AGE,
+    FEATHER_HEADER_ACCESS_CONTROL_REQUEST_HEADERS,
+    FEATHER_HEADER_ACCESS_CONTROL_REQUEST_METHOD,
+    FEATHER_HEADER_AGE,
+    FEATHER_HEADER_ALLOW,
+    FEATHER_HEADER_AUTHORIZATION,
+    FEATHER_HEADER_CACHE_CONTROL,
+    FEATHER_HEADER_CONNECTION,
+    FEATHER_HEADER_CONTENT_DISPOSITION,
+    FEATHER_HEADER_CONTENT_ENCODING,
+    FEATHER_HEADER_CONTENT_LANGUAGE,
+    FEATHER_HEADER_CONTENT_LENGTH,
+    FEATHER_HEADER_CONTENT_LOCATION,
+    FEATHER_HEADER_CONTENT_RANGE,
+    FEATHER_HEADER_CONTENT_SECURITY_POLICY,
+    FEATHER_HEADER_CONTENT_TYPE,
+    FEATHER_HEADER_COOKIE,
+    FEATHER_HEADER_DATE,
+    FEATHER_HEADER_DNT,
+    FEATHER_HEADER_ETAG,
+    FEATHER_HEADER_EXPECT,
+    FEATHER_HEADER_EXPIRES,
+    FEATHER_HEADER_FORWARDED,
+    FEATHER_HEADER_FROM,
+    FEATHER_HEADER_HOST,
+    FEATHER_HEADER_IF_MATCH,
+    FEATHER_HEADER_IF_MODIFIED_SINCE,
+    FEATHER_HEADER_IF_NONE_MATCH,
+    FEATHER_HEADER_IF_RANGE,
+    FEATHER_HEADER_IF_UNMODIFIED_SINCE,
+    FEATHER_HEADER_KEEP_ALIVE,
+    FEATHER_HEADER_LAST_MODIFIED,
+    FEATHER_HEADER_LINK,
+    FEATHER_HEADER_LOCATION,
+    FEATHER_HEADER_MAX_FORWARDS,
+    FEATHER_HEADER_ORIGIN,
+    FEATHER_HEADER_PRAGMA,
+    FEATHER_HEADER_PROXY_AUTHENTICATE,
+    FEATHER_HEADER_PROXY_AUTHORIZATION,
+    FEATHER_HEADER_RANGE,
+    FEATHER_HEADER_REFERER,
+    FEATHER_HEADER_RETRY_AFTER,
+    FEATHER_HEADER_SEC_FETCH_DEST,
+    FEATHER_HEADER_SEC_FETCH_MODE,
+    FEATHER_HEADER_SEC_FETCH_SITE,
+    FEATHER_HEADER_SEC_FETCH_USER,
+    FEATHER_HEADER_SERVER,
+    FEATHER_HEADER_SET_COOKIE,
+    FEATHER_HEADER_STRICT_TRANSPORT_SECURITY,
+    FEATHER_HEADER_TE,
+    FEATHER_HEADER_TRAILER,
+    FEATHER_HEADER_TRANSFER_ENCODING,
+    FEATHER_HEADER_UPGRADE,
+    FEATHER_HEADER_UPGRADE_INSECURE_REQUESTS,
+    FEATHER_HEADER_USER_AGENT,
+    FEATHER_HEADER_VARY,
+    FEATHER_HEADER_VIA,
+    FEATHER_HEADER_WWW_AUTHENTICATE,
+    FEATHER_HEADER_X_CONTENT_TYPE_OPTIONS,
+    FEATHER_HEADER_X_FORWARDED_FOR,
+    FEATHER_HEADER_X_FORWARDED_HOST,
+    FEATHER_HEADER_X_FORWARDED_PROTO,
+    FEATHER_HEADER_X_FRAME_OPTIONS,
+    FEATHER_HEADER_X_REAL_IP,
+    FEATHER_HEADER_X_REQUEST_ID,
+    FEATHER_HEADER_X_REQUESTED_WITH,
+    FEATHER_HEADER_COUNT,
+} FeatherHeaderId;
+
+#endif
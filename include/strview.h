@@ -36,10 +36,15 @@ static inline int __sv_eq_impl(StrView a, StrView b) {
 }
 
 
+// ASCII only: header names and tokens never need the locale, and this skips its lookups
+static inline char sv_ascii_lower(char c) {
+    return (char) (c + (((unsigned) ((unsigned char) c - 'A') < 26u) << 5));
+}
+
 static inline int __sv_ieq_impl(StrView a, StrView b) {
     if (a.len != b.len) return 0;
     for (size_t i = 0; i < a.len; ++i) {
-        if (tolower(a.ptr[i]) != tolower(b.ptr[i])) {
+        if (sv_ascii_lower(a.ptr[i]) != sv_ascii_lower(b.ptr[i])) {
             return 0;
         }
     }
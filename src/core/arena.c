@@ -0,0 +1,117 @@
+#include "feather.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct FeatherArenaBlock {
+    FeatherArenaBlock *next;
+    size_t cap;
+    _Alignas(FEATHER_ARENA_ALIGN) char data[];
+};
+
+void feather_arena_init(FeatherArena *arena, void *initial, size_t size) {
+    arena->initial = initial;
+    arena->initial_cap = size;
+    arena->blocks = NULL;
+    feather_arena_reset(arena);
+}
+
+// Heap blocks are kept for the next request, so a connection that keeps making the
+// same kind of request stops allocating after the first one. Oversized blocks made
+// for a single large allocation are the exception.
+void feather_arena_reset(FeatherArena *arena) {
+    FeatherArenaBlock **link = &arena->blocks;
+    while (*link) {
+        FeatherArenaBlock *block = *link;
+        if (block->cap > FEATHER_ARENA_BLOCK_SIZE) {
+            *link = block->next;
+            free(block);
+        } else {
+            link = &block->next;
+        }
+    }
+
+    arena->current = NULL;
+    arena->ptr = arena->initial;
+    arena->cap = arena->initial_cap;
+    arena->used = 0;
+}
+
+void feather_arena_deinit(FeatherArena *arena) {
+    while (arena->blocks) {
+        FeatherArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+
+    arena->current = NULL;
+    arena->ptr = NULL;
+    arena->cap = arena->used = 0;
+}
+
+// Moves on to the next kept block that can hold `size`, allocating one if none can
+static void arena_grow(FeatherArena *arena, size_t size) {
+    FeatherArenaBlock **link = arena->current ? &arena->current->next : &arena->blocks;
+
+    while (*link && (*link)->cap < size) link = &(*link)->next;
+
+    if (!*link) {
+        size_t cap = size > FEATHER_ARENA_BLOCK_SIZE ? size : FEATHER_ARENA_BLOCK_SIZE;
+        FeatherArenaBlock *block = malloc(sizeof(FeatherArenaBlock) + cap);
+        if (!block) {
+            perror("malloc");
+            exit(1);
+        }
+
+        block->cap = cap;
+        block->next = NULL;
+        *link = block;
+    }
+
+    arena->current = *link;
+    arena->ptr = arena->current->data;
+    arena->cap = arena->current->cap;
+    arena->used = 0;
+}
+
+void *feather_arena_alloc(FeatherArena *arena, size_t size) {
+    size = (size + FEATHER_ARENA_ALIGN - 1) & ~(size_t) (FEATHER_ARENA_ALIGN - 1);
+    if (size == 0) size = FEATHER_ARENA_ALIGN;
+
+    if (arena->cap - arena->used < size) arena_grow(arena, size);
+
+    void *ptr = arena->ptr + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+StrView feather_arena_vsprintf(FeatherArena *arena, const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+
+    // Try the space that's left first, it's usually enough
+    size_t room = arena->cap - arena->used;
+    int n = vsnprintf(arena->ptr + arena->used, room, fmt, args);
+    if (n < 0) {
+        va_end(copy);
+        return sv_from_buf(NULL, 0);
+    }
+
+    // Allocating the same bytes hands back the spot it was just written to
+    size_t aligned = ((size_t) n + FEATHER_ARENA_ALIGN) & ~(size_t) (FEATHER_ARENA_ALIGN - 1);
+    int written = aligned <= room;
+
+    char *out = feather_arena_alloc(arena, (size_t) n + 1);
+    if (!written) vsnprintf(out, (size_t) n + 1, fmt, copy);
+
+    va_end(copy);
+    return sv_from_buf(out, (size_t) n);
+}
+
+StrView feather_arena_sprintf(FeatherArena *arena, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    StrView out = feather_arena_vsprintf(arena, fmt, args);
+    va_end(args);
+    return out;
+}
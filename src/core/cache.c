@@ -0,0 +1,370 @@
+#include "feather.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef FEATHER_NO_ZLIB
+#include <zlib.h>
+#endif
+
+#define CACHE_BUCKETS 1024
+// Keys longer than this (path, query and vary headers together) aren't cached
+#define CACHE_MAX_KEY 2048
+// Smaller bodies gain too little from compression to be worth a second copy
+#define CACHE_MIN_COMPRESS 256
+
+typedef enum {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE,
+    ENCODING_COUNT,
+} Encoding;
+
+struct FeatherCacheEntry {
+    uint64_t hash;
+    char *key;
+    size_t key_len;
+    uint64_t expires;
+    size_t size;
+
+    // Status line and headers, then the blank line and body. The Date header
+    // goes in between whenever a variant is sent.
+    char *variants[ENCODING_COUNT];
+    size_t variant_lens[ENCODING_COUNT];
+    size_t head_lens[ENCODING_COUNT];
+
+    int refs;
+    int cached;
+    FeatherCacheEntry *bucket_next;
+    FeatherCacheEntry *prev;
+    FeatherCacheEntry *next;
+};
+
+// Shared by all workers. Lookups hold the lock only to find the entry and take a
+// reference; the bytes are written out without it.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static FeatherCacheEntry *buckets[CACHE_BUCKETS];
+static FeatherCacheEntry *lru_head = NULL;
+static FeatherCacheEntry *lru_tail = NULL;
+static size_t cache_budget = FEATHER_CACHE_DEFAULT_BUDGET;
+static FeatherCacheStats stats = {0};
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Method, then the path with its query, then the value of each vary header
+static size_t key_build(const FeatherRoute *route, const FeatherRequest *req, char *key) {
+    size_t len = 0;
+
+    key[len++] = (char) req->method;
+    if (len + req->path.len > CACHE_MAX_KEY) return 0;
+    memcpy(key + len, req->path.ptr, req->path.len);
+    len += req->path.len;
+
+    if (req->query.ptr) {
+        if (len + 1 + req->query.len > CACHE_MAX_KEY) return 0;
+        key[len++] = '?';
+        memcpy(key + len, req->query.ptr, req->query.len);
+        len += req->query.len;
+    }
+
+    for (const char *const *name = route->options.cache_vary; name && *name; ++name) {
+        StrView value = feather_get_header(&req->headers, sv_from_cstr(*name));
+        if (len + 1 + value.len > CACHE_MAX_KEY) return 0;
+
+        key[len++] = '\n';
+        memcpy(key + len, value.ptr, value.len);
+        len += value.len;
+    }
+
+    return len;
+}
+
+// Whether `name` is in Accept-Encoding without q=0
+static int accepts(StrView list, const char *name) {
+    while (list.len > 0) {
+        StrView item;
+        sv_split_once_strview(list, ",", &item, &list);
+
+        StrView coding, params;
+        sv_split_once_strview(item, ";", &coding, &params);
+
+        while (coding.len > 0 && coding.ptr[0] == ' ') coding = sv_from_buf(coding.ptr + 1, coding.len - 1);
+        while (coding.len > 0 && coding.ptr[coding.len - 1] == ' ') coding.len -= 1;
+        if (!sv_ieq(coding, name)) continue;
+
+        while (params.len > 0 && params.ptr[0] == ' ') params = sv_from_buf(params.ptr + 1, params.len - 1);
+        if (!sv_startswith(params, "q=0")) return 1;
+
+        // q=0, q=0. and q=0.000 refuse it, anything like q=0.5 doesn't
+        for (size_t i = 3; i < params.len; ++i) {
+            if (params.ptr[i] >= '1' && params.ptr[i] <= '9') return 1;
+            if (params.ptr[i] != '.' && params.ptr[i] != '0') break;
+        }
+        return 0;
+    }
+
+    return 0;
+}
+
+static void pick_variant(const FeatherCacheEntry *entry, const FeatherRequest *req, StrView *head, StrView *rest) {
+    Encoding encoding = ENCODING_IDENTITY;
+
+    if (entry->variants[ENCODING_GZIP] || entry->variants[ENCODING_DEFLATE]) {
+        StrView accept = feather_get_header_id(&req->headers, FEATHER_HEADER_ACCEPT_ENCODING);
+
+        if (entry->variants[ENCODING_GZIP] && accepts(accept, "gzip")) encoding = ENCODING_GZIP;
+        else if (entry->variants[ENCODING_DEFLATE] && accepts(accept, "deflate")) encoding = ENCODING_DEFLATE;
+    }
+
+    const char *bytes = entry->variants[encoding];
+    size_t head_len = entry->head_lens[encoding];
+
+    *head = sv_from_buf(bytes, head_len);
+    *rest = sv_from_buf(bytes + head_len, entry->variant_lens[encoding] - head_len);
+}
+
+static void entry_free(FeatherCacheEntry *entry) {
+    for (int i = 0; i < ENCODING_COUNT; ++i) free(entry->variants[i]);
+    free(entry->key);
+    free(entry);
+}
+
+static void lru_unlink(FeatherCacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else lru_head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else lru_tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(FeatherCacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = lru_head;
+    if (lru_head) lru_head->prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+// With cache_lock held. Entries still being sent are freed by their last release.
+static void entry_drop(FeatherCacheEntry *entry) {
+    FeatherCacheEntry **link = &buckets[entry->hash % CACHE_BUCKETS];
+    while (*link != entry) link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
+
+    lru_unlink(entry);
+    entry->cached = 0;
+    stats.bytes -= entry->size;
+    stats.entries -= 1;
+
+    if (entry->refs == 0) entry_free(entry);
+}
+
+static FeatherCacheEntry *entry_find(const char *key, size_t len, uint64_t hash) {
+    for (FeatherCacheEntry *entry = buckets[hash % CACHE_BUCKETS]; entry; entry = entry->bucket_next) {
+        if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, key, len) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Everything but the Date header of `res`, with `extra` after its other headers.
+// `head_len` is set to where the blank line starts.
+static char *serialize(const FeatherResponse *res, StrView body, StrView extra, size_t *len, size_t *head_len) {
+    FeatherResponse copy = *res;
+    copy.body = body;
+    copy.headers.content_length = sv_from_buf(NULL, 0);
+    copy.headers.connection = sv_from_buf(NULL, 0);
+
+    size_t cap = 512 + extra.len + body.len;
+    char *buf = malloc(cap);
+
+    size_t head;
+    while (!(head = feather_dump_response_fields(&copy, buf, cap - body.len - extra.len - 2))) {
+        cap *= 2;
+        buf = realloc(buf, cap);
+    }
+
+    memcpy(buf + head, extra.ptr, extra.len);
+    head += extra.len;
+    *head_len = head;
+
+    memcpy(buf + head, "\r\n", 2);
+    memcpy(buf + head + 2, body.ptr, body.len);
+    *len = head + 2 + body.len;
+    return buf;
+}
+
+#ifndef FEATHER_NO_ZLIB
+// Returns a heap buffer with `body` compressed in gzip (window_bits 31) or zlib (15)
+// format, or NULL if that doesn't make it at least an eighth smaller
+static char *compress_body(StrView body, int window_bits, size_t *len) {
+    z_stream zs = {0};
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+
+    size_t cap = deflateBound(&zs, body.len);
+    char *out = malloc(cap);
+
+    zs.next_in = (Bytef *) body.ptr;
+    zs.avail_in = (uInt) body.len;
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = (uInt) cap;
+
+    int res = deflate(&zs, Z_FINISH);
+    *len = zs.total_out;
+    deflateEnd(&zs);
+
+    if (res != Z_STREAM_END || *len > body.len - body.len / 8) {
+        free(out);
+        return NULL;
+    }
+
+    return out;
+}
+#endif
+
+FeatherCacheEntry *feather_cache_lookup(const FeatherRoute *route, const FeatherRequest *req, StrView *head, StrView *rest) {
+    char key[CACHE_MAX_KEY];
+    size_t key_len = key_build(route, req, key);
+    if (!key_len) return NULL;
+
+    uint64_t hash = key_hash(key, key_len);
+
+    pthread_mutex_lock(&cache_lock);
+
+    FeatherCacheEntry *entry = entry_find(key, key_len, hash);
+    if (entry && entry->expires <= now_ms()) {
+        entry_drop(entry);
+        entry = NULL;
+    }
+
+    if (entry) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        entry->refs += 1;
+        stats.hits += 1;
+    } else {
+        stats.misses += 1;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    if (entry) pick_variant(entry, req, head, rest);
+    return entry;
+}
+
+FeatherCacheEntry *feather_cache_store(const FeatherRoute *route, const FeatherRequest *req, const FeatherResponse *res, StrView *head, StrView *rest) {
+    if (res->status != 200 || route->options.cache_ttl_ms <= 0) return NULL;
+
+    char key[CACHE_MAX_KEY];
+    size_t key_len = key_build(route, req, key);
+    if (!key_len) return NULL;
+
+    // Too big for the budget to hold more than a handful of
+    if (res->body.len > cache_budget / 8) return NULL;
+
+    FeatherCacheEntry *entry = calloc(1, sizeof(FeatherCacheEntry));
+    entry->key = malloc(key_len);
+    memcpy(entry->key, key, key_len);
+    entry->key_len = key_len;
+    entry->hash = key_hash(key, key_len);
+    entry->expires = now_ms() + (uint64_t) route->options.cache_ttl_ms;
+
+    int vary = 0;
+#ifndef FEATHER_NO_ZLIB
+    // A body that's already encoded is stored as it is
+    int compress = route->options.cache_compress && res->body.len >= CACHE_MIN_COMPRESS
+        && feather_get_header_id(&res->headers, FEATHER_HEADER_CONTENT_ENCODING).len == 0;
+
+    if (compress) {
+        static const struct { Encoding encoding; int window_bits; StrView extra; } codings[] = {
+            { ENCODING_GZIP, 31, SV_LIT("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n") },
+            { ENCODING_DEFLATE, 15, SV_LIT("Content-Encoding: deflate\r\nVary: Accept-Encoding\r\n") },
+        };
+
+        for (size_t i = 0; i < sizeof(codings) / sizeof(codings[0]); ++i) {
+            size_t len;
+            char *body = compress_body(res->body, codings[i].window_bits, &len);
+            if (!body) continue;
+
+            Encoding e = codings[i].encoding;
+            entry->variants[e] = serialize(res, sv_from_buf(body, len), codings[i].extra, &entry->variant_lens[e], &entry->head_lens[e]);
+            entry->size += entry->variant_lens[e];
+            free(body);
+            vary = 1;
+        }
+    }
+#endif
+
+    // Once there are other variants, shared caches downstream must tell them apart too
+    StrView extra = vary ? SV_LIT("Vary: Accept-Encoding\r\n") : sv_from_buf(NULL, 0);
+    entry->variants[ENCODING_IDENTITY] = serialize(res, res->body, extra, &entry->variant_lens[ENCODING_IDENTITY], &entry->head_lens[ENCODING_IDENTITY]);
+    entry->size += entry->variant_lens[ENCODING_IDENTITY] + key_len + sizeof(FeatherCacheEntry);
+
+    entry->refs = 1;
+    entry->cached = 1;
+
+    pthread_mutex_lock(&cache_lock);
+
+    // Another miss for the same key may have been stored meanwhile
+    FeatherCacheEntry *old = entry_find(entry->key, key_len, entry->hash);
+    if (old) entry_drop(old);
+
+    entry->bucket_next = buckets[entry->hash % CACHE_BUCKETS];
+    buckets[entry->hash % CACHE_BUCKETS] = entry;
+    lru_push_front(entry);
+    stats.bytes += entry->size;
+    stats.entries += 1;
+    stats.stores += 1;
+
+    while (stats.bytes > cache_budget && lru_tail != entry) {
+        entry_drop(lru_tail);
+        stats.evictions += 1;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    pick_variant(entry, req, head, rest);
+    return entry;
+}
+
+void feather_cache_release(FeatherCacheEntry *entry) {
+    pthread_mutex_lock(&cache_lock);
+    int last = --entry->refs == 0 && !entry->cached;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (last) entry_free(entry);
+}
+
+void feather_set_cache_budget(size_t bytes) {
+    pthread_mutex_lock(&cache_lock);
+
+    cache_budget = bytes;
+    while (stats.bytes > cache_budget && lru_tail) {
+        entry_drop(lru_tail);
+        stats.evictions += 1;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void feather_cache_stats(FeatherCacheStats *out) {
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -1,11 +1,12 @@
 #include "feather.h"
 #include "strview.h"
+#include "header_table.h"
 #include <assert.h>
-#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <threads.h>
 #include <time.h>
 
 const char *feather_method_to_str(FeatherMethod method) {
@@ -37,91 +38,195 @@ FeatherMethod feather_sv_to_method(StrView str) {
 void feather_parse_request(FeatherRequest *req, StrView raw) {
     assert(req != NULL);
 
-    StrView line;
-    sv_split_once_strview(raw, "\r\n", &line, &raw);
+    FeatherScan scan;
+    feather_scan_reset(&scan);
+    feather_scan_request(&scan, raw.ptr, raw.len);
+    feather_parse_scanned(req, raw.ptr, &scan);
 
-    StrView method, tmp;
-    sv_split_once_strview(line, " ", &method, &tmp);
+    req->body = scan.header_end ? sv_from_buf(raw.ptr + scan.header_end, raw.len - scan.header_end) : sv_from_buf(NULL, 0);
+}
 
-    StrView version;
-    sv_split_once_strview(tmp, " ", &req->path, &version);
+#define STATUS_LINE(code, reason) [code - 100] = SV_LIT("HTTP/1.1 " #code " " reason "\r\n")
+
+// Every registered code, so the status line is a single copy
+static const StrView status_lines[500] = {
+    STATUS_LINE(100, "Continue"),
+    STATUS_LINE(101, "Switching Protocols"),
+    STATUS_LINE(102, "Processing"),
+    STATUS_LINE(103, "Early Hints"),
+    STATUS_LINE(200, "OK"),
+    STATUS_LINE(201, "Created"),
+    STATUS_LINE(202, "Accepted"),
+    STATUS_LINE(203, "Non-Authoritative Information"),
+    STATUS_LINE(204, "No Content"),
+    STATUS_LINE(205, "Reset Content"),
+    STATUS_LINE(206, "Partial Content"),
+    STATUS_LINE(207, "Multi-Status"),
+    STATUS_LINE(208, "Already Reported"),
+    STATUS_LINE(226, "IM Used"),
+    STATUS_LINE(300, "Multiple Choices"),
+    STATUS_LINE(301, "Moved Permanently"),
+    STATUS_LINE(302, "Found"),
+    STATUS_LINE(303, "See Other"),
+    STATUS_LINE(304, "Not Modified"),
+    STATUS_LINE(305, "Use Proxy"),
+    STATUS_LINE(307, "Temporary Redirect"),
+    STATUS_LINE(308, "Permanent Redirect"),
+    STATUS_LINE(400, "Bad Request"),
+    STATUS_LINE(401, "Unauthorized"),
+    STATUS_LINE(402, "Payment Required"),
+    STATUS_LINE(403, "Forbidden"),
+    STATUS_LINE(404, "Not Found"),
+    STATUS_LINE(405, "Method Not Allowed"),
+    STATUS_LINE(406, "Not Acceptable"),
+    STATUS_LINE(407, "Proxy Authentication Required"),
+    STATUS_LINE(408, "Request Timeout"),
+    STATUS_LINE(409, "Conflict"),
+    STATUS_LINE(410, "Gone"),
+    STATUS_LINE(411, "Length Required"),
+    STATUS_LINE(412, "Precondition Failed"),
+    STATUS_LINE(413, "Content Too Large"),
+    STATUS_LINE(414, "URI Too Long"),
+    STATUS_LINE(415, "Unsupported Media Type"),
+    STATUS_LINE(416, "Range Not Satisfiable"),
+    STATUS_LINE(417, "Expectation Failed"),
+    STATUS_LINE(421, "Misdirected Request"),
+    STATUS_LINE(422, "Unprocessable Content"),
+    STATUS_LINE(423, "Locked"),
+    STATUS_LINE(424, "Failed Dependency"),
+    STATUS_LINE(425, "Too Early"),
+    STATUS_LINE(426, "Upgrade Required"),
+    STATUS_LINE(428, "Precondition Required"),
+    STATUS_LINE(429, "Too Many Requests"),
+    STATUS_LINE(431, "Request Header Fields Too Large"),
+    STATUS_LINE(451, "Unavailable For Legal Reasons"),
+    STATUS_LINE(500, "Internal Server Error"),
+    STATUS_LINE(501, "Not Implemented"),
+    STATUS_LINE(502, "Bad Gateway"),
+    STATUS_LINE(503, "Service Unavailable"),
+    STATUS_LINE(504, "Gateway Timeout"),
+    STATUS_LINE(505, "HTTP Version Not Supported"),
+    STATUS_LINE(506, "Variant Also Negotiates"),
+    STATUS_LINE(507, "Insufficient Storage"),
+    STATUS_LINE(508, "Loop Detected"),
+    STATUS_LINE(510, "Not Extended"),
+    STATUS_LINE(511, "Network Authentication Required"),
+};
+
+#undef STATUS_LINE
+
+// "Date: <IMF-fixdate>\r\n", rewritten once a second by each worker's event loop
+#define DATE_LINE_LEN (sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1)
+
+thread_local static char date_line[DATE_LINE_LEN + 1];
+
+void feather_update_date(time_t now) {
+    struct tm tm;
+    gmtime_r(&now, &tm);
+    strftime(date_line, sizeof(date_line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+}
 
-    req->method = feather_sv_to_method(method);
+StrView feather_date_header(void) {
+    // Threads without an event loop get the time of their first response
+    if (!date_line[0]) feather_update_date(time(NULL));
 
-    if (!version.len) return;
-    
-    while (raw.len > 0) {
-        sv_split_once_strview(raw, "\r\n", &line, &raw);        
+    return sv_from_buf(date_line, DATE_LINE_LEN);
+}
 
-        if (line.len == 0) break;
+// The emitters below return 0 once `buf` is full, like the dump functions built on them
 
-        StrView key, value;
-        if (!sv_split_once_strview(line, ":", &key, &value)) continue;
+static inline int put(char *buf, size_t cap, size_t *offset, const char *data, size_t len) {
+    if (len > cap - *offset) return 0;
 
-        while (value.len > 0 && value.ptr[0] == ' ') {
-            value.ptr += 1;
-            value.len -= 1;
-        }
+    memcpy(buf + *offset, data, len);
+    *offset += len;
+    return 1;
+}
 
-        feather_set_header(&req->headers, key, value);
-    }
+static inline int put_uint(char *buf, size_t cap, size_t *offset, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
 
-    req->body = raw;
+    do {
+        digits[sizeof(digits) - ++n] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    return put(buf, cap, offset, digits + sizeof(digits) - n, n);
 }
 
-static const char *status_reason(int code) {
-    switch (code) {
-        case 200: return "OK";
-        case 201: return "Created";
-        case 204: return "No content";
-        case 400: return "Bad Request";
-        case 404: return "Not Found";
-        case 500: return "Internal Server Error";
+static inline int put_header(char *buf, size_t cap, size_t *offset, StrView key, StrView value) {
+    if (value.len == 0) return 1;
 
-        default: return "";
-    }
+    size_t len = key.len + 2 + value.len + 2;
+    if (len > cap - *offset) return 0;
+
+    char *p = buf + *offset;
+    memcpy(p, key.ptr, key.len);
+    p += key.len;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, value.ptr, value.len);
+    p += value.len;
+    *p++ = '\r';
+    *p++ = '\n';
+
+    *offset += len;
+    return 1;
 }
 
-size_t feather_dump_response(const FeatherResponse *res, char *buf, size_t buf_size) {
+size_t feather_dump_response_fields(const FeatherResponse *res, char *buf, size_t buf_size) {
     if (!res || !buf) return 0;
 
     size_t offset = 0;
 
-    int n = snprintf(buf + offset, buf_size - offset, "HTTP/1.1 %d %s\r\n", res->status, status_reason(res->status));
-
-    if (n < 0 || (size_t) n >= buf_size - offset) return 0;
-    offset += (size_t) n;
-
-#define WRITE_HEADER(key, value) \
-    do { \
-        if ((value).len > 0) { \
-            n = snprintf(buf + offset, buf_size - offset, SV_FMT": "SV_FMT"\r\n", SV_ARG(key), SV_ARG(value)); \
-            if (n < 0 || (size_t) n >= buf_size - offset) return 0; \
-            offset += (size_t) n; \
-        } \
-    } while (0)
+    if (res->status >= 100 && res->status < 600 && status_lines[res->status - 100].len) {
+        StrView line = status_lines[res->status - 100];
+        if (!put(buf, buf_size, &offset, line.ptr, line.len)) return 0;
+    } else {
+        // Unregistered codes go out without a reason phrase
+        if (!put(buf, buf_size, &offset, "HTTP/1.1 ", 9)) return 0;
+        if (!put_uint(buf, buf_size, &offset, (uint64_t) (res->status > 0 ? res->status : 0))) return 0;
+        if (!put(buf, buf_size, &offset, " \r\n", 3)) return 0;
+    }
 
-    WRITE_HEADER(SV_LIT("Authorization"), res->headers.authorization);
-    WRITE_HEADER(SV_LIT("Cookie"), res->headers.cookie);
-    WRITE_HEADER(SV_LIT("Content-Type"), res->headers.content_type);
-    WRITE_HEADER(SV_LIT("Content-Length"), res->headers.content_length);
+    if (!put_header(buf, buf_size, &offset, SV_LIT("Authorization"), res->headers.authorization)) return 0;
+    if (!put_header(buf, buf_size, &offset, SV_LIT("Cookie"), res->headers.cookie)) return 0;
+    if (!put_header(buf, buf_size, &offset, SV_LIT("Content-Type"), res->headers.content_type)) return 0;
+    if (!put_header(buf, buf_size, &offset, SV_LIT("Content-Length"), res->headers.content_length)) return 0;
 
     if (!res->headers.content_length.len && res->body.len > 0) {
-        n = snprintf(buf + offset, buf_size - offset, "Content-Length: %zu\r\n", res->body.len);
-        if (n < 0 || (size_t) n >= buf_size - offset) return 0;
-        offset += (size_t) n;
+        if (!put(buf, buf_size, &offset, "Content-Length: ", 16)) return 0;
+        if (!put_uint(buf, buf_size, &offset, res->body.len)) return 0;
+        if (!put(buf, buf_size, &offset, "\r\n", 2)) return 0;
     }
 
     darr_foreach(FeatherHeader, &res->headers.other, header) {
-        WRITE_HEADER(header->key, header->value);
+        if (!put_header(buf, buf_size, &offset, header->key, header->value)) return 0;
     }
-#undef WRITE_HEADER
+
+    return offset;
+}
+
+size_t feather_dump_response_head(const FeatherResponse *res, char *buf, size_t buf_size) {
+    size_t offset = feather_dump_response_fields(res, buf, buf_size);
+    if (!offset) return 0;
+
+    StrView date = feather_date_header();
+    if (!put(buf, buf_size, &offset, date.ptr, date.len)) return 0;
 
     if (offset + 2 >= buf_size) return 0;
 
     buf[offset++] = '\r';
     buf[offset++] = '\n';
 
+    return offset;
+}
+
+size_t feather_dump_response(const FeatherResponse *res, char *buf, size_t buf_size) {
+    size_t offset = feather_dump_response_head(res, buf, buf_size);
+    if (!offset) return 0;
+
     if (res->body.len > 0) {
         if (offset + res->body.len >= buf_size) return 0;
         memcpy(buf + offset, res->body.ptr, res->body.len);
@@ -131,66 +236,331 @@ size_t feather_dump_response(const FeatherResponse *res, char *buf, size_t buf_s
     return offset;
 }
 
+// Arena-backed arrays start smaller than a DynArr; most requests carry only a few extra headers
+#define ARENA_HEADERS_INIT_CAP 16
+
+static void headers_push(FeatherHeaders *headers, FeatherHeader header) {
+    if (!headers->arena) {
+        darr_push(&headers->other, header);
+        return;
+    }
+
+    if (headers->other.size == headers->other.cap) {
+        size_t cap = headers->other.cap ? headers->other.cap * 2 : ARENA_HEADERS_INIT_CAP;
+        FeatherHeader *items = feather_arena_alloc(headers->arena, cap * sizeof(FeatherHeader));
+        if (headers->other.size) memcpy(items, headers->other.items, headers->other.size * sizeof(FeatherHeader));
+
+        headers->other.items = items;
+        headers->other.cap = cap;
+    }
+
+    headers->other.items[headers->other.size++] = header;
+}
+
+// Must match key() in tools/gen_headers.py
+static inline uint32_t header_key(StrView name) {
+    const unsigned char *p = (const unsigned char *) name.ptr;
+    size_t len = name.len;
+
+    return (uint32_t) (unsigned char) sv_ascii_lower((char) p[0])
+        | (uint32_t) (unsigned char) sv_ascii_lower((char) p[len - 1]) << 8
+        | (uint32_t) (unsigned char) sv_ascii_lower((char) p[len >= 3 ? len - 3 : 0]) << 16
+        | (uint32_t) len << 24;
+}
+
+FeatherHeaderId feather_header_id(StrView name) {
+    if (name.len == 0 || name.len > 0xFF) return FEATHER_HEADER_OTHER;
+
+    uint32_t slot = (header_key(name) * HEADER_TABLE_SEED) >> (32 - HEADER_TABLE_BITS);
+    FeatherHeaderId id = header_slots[slot];
+
+    // The table only knows where a standard name would land, so the name itself is still checked
+    StrView known = header_names[id];
+    if (id == FEATHER_HEADER_OTHER || known.len != name.len) return FEATHER_HEADER_OTHER;
+
+    // Most clients send the canonical spelling
+    if (memcmp(name.ptr, known.ptr, name.len) == 0 || sv_ieq(name, known)) return id;
+    return FEATHER_HEADER_OTHER;
+}
+
 void feather_set_header(FeatherHeaders *headers, StrView key, StrView value) {
-    if (sv_ieq(key, "Authorization")) {
-        headers->authorization = value;
-    } else if (sv_ieq(key, "Cookie")) {
-        headers->cookie = value;
-    } else if (sv_ieq(key, "Content-Type")) {
-        headers->content_type = value;
-    } else if (sv_ieq(key, "Content-Length")) {
-        headers->content_length = value;
-    } else if (sv_ieq(key, "Connection")) {
-        headers->connection = value;
-    } else {
-        darr_foreach(FeatherHeader, &headers->other, header) {
-            if (sv_ieq(header->key, key)) {
-                header->value = value;
+    FeatherHeaderId id = feather_header_id(key);
+
+    switch (id) {
+        case FEATHER_HEADER_AUTHORIZATION: headers->authorization = value; return;
+        case FEATHER_HEADER_COOKIE: headers->cookie = value; return;
+        case FEATHER_HEADER_CONTENT_TYPE: headers->content_type = value; return;
+        case FEATHER_HEADER_CONTENT_LENGTH: headers->content_length = value; return;
+        case FEATHER_HEADER_CONNECTION: headers->connection = value; return;
+
+        case FEATHER_HEADER_OTHER:
+            darr_foreach(FeatherHeader, &headers->other, header) {
+                if (header->id == FEATHER_HEADER_OTHER && sv_ieq(header->key, key)) {
+                    header->value = value;
+                    return;
+                }
+            }
+            break;
+
+        default:
+            if (headers->index[id]) {
+                headers->other.items[headers->index[id] - 1].value = value;
                 return;
             }
-        }
+            break;
+    }
 
-        darr_push(&headers->other, ((FeatherHeader) { key, value }));
+    headers_push(headers, (FeatherHeader) { key, value, id });
+    if (id != FEATHER_HEADER_OTHER && headers->other.size <= UINT16_MAX) {
+        headers->index[id] = (uint16_t) headers->other.size;
     }
 }
 
-StrView feather_get_header(const FeatherHeaders *headers, StrView key) {
-    if (sv_ieq(key, "Authorization")) {
-        return headers->authorization;
-    } else if (sv_ieq(key, "Cookie")) {
-        return headers->cookie;
-    } else if (sv_ieq(key, "Content-Type")) {
-        return headers->content_type;
-    } else if (sv_ieq(key, "Content-Length")) {
-        return headers->content_length;
-    } else if (sv_ieq(key, "Connection")) {
-        return headers->connection;
-    } else {
-        darr_foreach(FeatherHeader, &headers->other, header) {
-            if (sv_ieq(header->key, key)) {
-                return header->value;
+void feather_headers_deinit(FeatherHeaders *headers) {
+    if (!headers->arena && headers->other.cap) darr_deinit(&headers->other);
+
+    headers->other.items = NULL;
+    headers->other.size = headers->other.cap = 0;
+    memset(headers->index, 0, sizeof(headers->index));
+}
+
+StrView feather_get_header_id(const FeatherHeaders *headers, FeatherHeaderId id) {
+    switch (id) {
+        case FEATHER_HEADER_AUTHORIZATION: return headers->authorization;
+        case FEATHER_HEADER_COOKIE: return headers->cookie;
+        case FEATHER_HEADER_CONTENT_TYPE: return headers->content_type;
+        case FEATHER_HEADER_CONTENT_LENGTH: return headers->content_length;
+        case FEATHER_HEADER_CONNECTION: return headers->connection;
+
+        default:
+            if (id > FEATHER_HEADER_OTHER && id < FEATHER_HEADER_COUNT && headers->index[id]) {
+                return headers->other.items[headers->index[id] - 1].value;
             }
-        }
+            return sv_from_buf(NULL, 0);
+    }
+}
 
-        return sv_from_buf(NULL, 0);
+StrView feather_get_header(const FeatherHeaders *headers, StrView key) {
+    FeatherHeaderId id = feather_header_id(key);
+    if (id != FEATHER_HEADER_OTHER) return feather_get_header_id(headers, id);
+
+    darr_foreach(FeatherHeader, &headers->other, header) {
+        if (header->id == FEATHER_HEADER_OTHER && sv_ieq(header->key, key)) {
+            return header->value;
+        }
     }
-} 
+
+    return sv_from_buf(NULL, 0);
+}
 
 void feather_init_app(FeatherApp *app) {
     app->routes = NULL;
     app->route_count = 0;
+    app->nodes = NULL;
+    app->node_count = 0;
+    app->frozen = 0;
+    app->mounts = NULL;
+    app->mount_count = 0;
+
+    for (size_t i = 0; i <= FEATHER_UNKNOWN; ++i) {
+        app->roots[i] = FEATHER_NO_NODE;
+    }
 }
 
 void feather_add_route(FeatherApp *app, FeatherMethod method, const char *path, FeatherHandler handler) {
+    feather_add_route_opts(app, method, path, handler, (FeatherRouteOptions) {0});
+}
+
+void feather_add_route_opts(FeatherApp *app, FeatherMethod method, const char *path, FeatherHandler handler, FeatherRouteOptions options) {
+    assert(!app->frozen);
+
     app->routes = realloc(app->routes, (app->route_count + 1) * sizeof(FeatherRoute));
     app->routes[app->route_count].method = method;
     app->routes[app->route_count].pattern = sv_from_cstr(path);
     app->routes[app->route_count].handler = handler;
+    app->routes[app->route_count].options = options;
+    app->routes[app->route_count].param_keys = NULL;
+    app->routes[app->route_count].param_count = 0;
 
     app->route_count += 1;
 }
 
-static int feather_match_route(StrView pattern, FeatherRequest *req) {
+// Splits the next '/'-separated segment off `rem`. `done` is set once the last one is taken.
+static int next_segment(StrView *rem, int *done, StrView *seg) {
+    if (*done) return 0;
+
+    const char *slash = memchr(rem->ptr, '/', rem->len);
+    if (!slash) {
+        *seg = *rem;
+        *rem = sv_from_buf(NULL, 0);
+        *done = 1;
+        return 1;
+    }
+
+    size_t len = slash - rem->ptr;
+    *seg = sv_from_buf(rem->ptr, len);
+    *rem = sv_from_buf(slash + 1, rem->len - len - 1);
+    return 1;
+}
+
+static int segment_cmp(StrView a, StrView b) {
+    if (a.len != b.len) return a.len < b.len ? -1 : 1;
+    return memcmp(a.ptr, b.ptr, a.len);
+}
+
+typedef struct RouteBuildNode RouteBuildNode;
+
+struct RouteBuildNode {
+    StrView segment;
+    DynArr(RouteBuildNode *) children;
+    RouteBuildNode *param;
+    uint32_t route;
+};
+
+static RouteBuildNode *build_node_new(StrView segment) {
+    RouteBuildNode *node = calloc(1, sizeof(RouteBuildNode));
+    node->segment = segment;
+    node->route = FEATHER_NO_ROUTE;
+    return node;
+}
+
+static void build_node_free(RouteBuildNode *node) {
+    if (!node) return;
+
+    darr_foreach(RouteBuildNode *, &node->children, child) {
+        build_node_free(*child);
+    }
+    if (node->children.cap) darr_deinit(&node->children);
+
+    build_node_free(node->param);
+    free(node);
+}
+
+static size_t build_node_count(const RouteBuildNode *node) {
+    if (!node) return 0;
+
+    size_t count = 1 + build_node_count(node->param);
+    darr_foreach(RouteBuildNode *, &node->children, child) {
+        count += build_node_count(*child);
+    }
+
+    return count;
+}
+
+static int build_node_cmp(const void *a, const void *b) {
+    return segment_cmp((*(RouteBuildNode **) a)->segment, (*(RouteBuildNode **) b)->segment);
+}
+
+static void build_node_insert(RouteBuildNode *root, FeatherRoute *route, uint32_t route_idx) {
+    StrView keys[__FEATHER_MAX_PARAMS + 1];
+    size_t key_count = 0;
+
+    StrView rem = sv_rstrip_char(route->pattern, '/');
+    int done = rem.len == 0;
+    StrView seg;
+
+    RouteBuildNode *node = root;
+    while (next_segment(&rem, &done, &seg)) {
+        if (seg.len > 0 && seg.ptr[0] == ':') {
+            if (key_count <= __FEATHER_MAX_PARAMS) {
+                keys[key_count] = sv_from_buf(seg.ptr + 1, seg.len - 1);
+            }
+            key_count += 1;
+
+            if (!node->param) node->param = build_node_new(seg);
+            node = node->param;
+            continue;
+        }
+
+        RouteBuildNode *next = NULL;
+        darr_foreach(RouteBuildNode *, &node->children, child) {
+            if (sv_eq((*child)->segment, seg)) {
+                next = *child;
+                break;
+            }
+        }
+
+        if (!next) {
+            next = build_node_new(seg);
+            darr_push(&node->children, next);
+        }
+        node = next;
+    }
+
+    // A pattern with too many params can never match, same as with feather_match_route
+    if (key_count > __FEATHER_MAX_PARAMS) return;
+
+    route->param_count = key_count;
+    if (key_count > 0) {
+        route->param_keys = malloc(key_count * sizeof(StrView));
+        memcpy(route->param_keys, keys, key_count * sizeof(StrView));
+    }
+
+    // Earlier registrations win, like they did with the linear scan
+    if (node->route == FEATHER_NO_ROUTE) node->route = route_idx;
+}
+
+static void flatten_node(FeatherApp *app, RouteBuildNode *src, uint32_t idx) {
+    FeatherRouteNode *node = &app->nodes[idx];
+
+    if (src->children.size > 1) {
+        darr_sort(&src->children, build_node_cmp);
+    }
+
+    node->segment = src->segment;
+    node->route = src->route;
+    node->child_count = src->children.size;
+    node->first_child = app->node_count;
+    app->node_count += node->child_count;
+    node->param_child = src->param ? app->node_count++ : FEATHER_NO_NODE;
+
+    for (uint32_t i = 0; i < node->child_count; ++i) {
+        flatten_node(app, src->children.items[i], node->first_child + i);
+    }
+
+    if (src->param) {
+        flatten_node(app, src->param, node->param_child);
+    }
+}
+
+void feather_freeze_app(FeatherApp *app) {
+    if (app->frozen) return;
+
+    RouteBuildNode *roots[FEATHER_UNKNOWN + 1] = {0};
+    size_t total = 0;
+
+    for (size_t i = 0; i < app->route_count; ++i) {
+        FeatherRoute *route = &app->routes[i];
+        if (!roots[route->method]) {
+            roots[route->method] = build_node_new(sv_from_buf(NULL, 0));
+        }
+
+        build_node_insert(roots[route->method], route, i);
+    }
+
+    for (size_t m = 0; m <= FEATHER_UNKNOWN; ++m) {
+        total += build_node_count(roots[m]);
+    }
+
+    app->nodes = malloc((total ? total : 1) * sizeof(FeatherRouteNode));
+    app->node_count = 0;
+
+    // Also for methods without routes, so a zero-initialized app is fine too
+    for (size_t m = 0; m <= FEATHER_UNKNOWN; ++m) {
+        if (!roots[m]) {
+            app->roots[m] = FEATHER_NO_NODE;
+            continue;
+        }
+
+        app->roots[m] = app->node_count++;
+        flatten_node(app, roots[m], app->roots[m]);
+        build_node_free(roots[m]);
+    }
+
+    app->frozen = 1;
+}
+
+int feather_match_route(StrView pattern, FeatherRequest *req) {
     req->param_count = 0;
 
 
@@ -237,35 +607,272 @@ static int feather_match_route(StrView pattern, FeatherRequest *req) {
     return path_rem.len == 0;
 }
 
-FeatherHandler feather_find_handler(const FeatherApp *app, FeatherRequest *req) {
-    FEATHER_LOG_REQUEST(req);
-    for (size_t i = 0; i < app->route_count; ++i) {
-        if (
-            app->routes[i].method == req->method &&
-            feather_match_route(app->routes[i].pattern, req)
-        ) {
-            return app->routes[i].handler;
+static uint32_t find_child(const FeatherApp *app, const FeatherRouteNode *node, StrView seg) {
+    uint32_t lo = node->first_child;
+    uint32_t hi = node->first_child + node->child_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = segment_cmp(app->nodes[mid].segment, seg);
+
+        if (cmp == 0) return mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return FEATHER_NO_NODE;
+}
+
+// Static segments take precedence over params; a param edge is only tried if the static subtree fails
+static uint32_t route_lookup(const FeatherApp *app, uint32_t idx, StrView rem, int done, FeatherRequest *req) {
+    const FeatherRouteNode *node = &app->nodes[idx];
+
+    StrView seg;
+    if (!next_segment(&rem, &done, &seg)) return node->route;
+
+    uint32_t child = find_child(app, node, seg);
+    if (child != FEATHER_NO_NODE) {
+        uint32_t route = route_lookup(app, child, rem, done, req);
+        if (route != FEATHER_NO_ROUTE) return route;
+    }
+
+    if (node->param_child != FEATHER_NO_NODE && seg.len > 0 && req->param_count < __FEATHER_MAX_PARAMS) {
+        size_t slot = req->param_count++;
+        req->params[slot].value = seg;
+
+        uint32_t route = route_lookup(app, node->param_child, rem, done, req);
+        if (route != FEATHER_NO_ROUTE) return route;
+
+        req->param_count = slot;
+    }
+
+    return FEATHER_NO_ROUTE;
+}
+
+const FeatherRoute *feather_find_route(const FeatherApp *app, FeatherRequest *req) {
+    if (!app->frozen) {
+        for (size_t i = 0; i < app->route_count; ++i) {
+            if (
+                app->routes[i].method == req->method &&
+                feather_match_route(app->routes[i].pattern, req)
+            ) {
+                return &app->routes[i];
+            }
         }
+
+        return NULL;
+    }
+
+    req->param_count = 0;
+
+    uint32_t root = app->roots[req->method];
+    if (root == FEATHER_NO_NODE) return NULL;
+
+    StrView path = sv_rstrip_char(req->path, '/');
+    uint32_t idx = route_lookup(app, root, path, path.len == 0, req);
+    if (idx == FEATHER_NO_ROUTE) return NULL;
+
+    const FeatherRoute *route = &app->routes[idx];
+    for (size_t i = 0; i < req->param_count; ++i) {
+        req->params[i].key = route->param_keys[i];
+    }
+
+    return route;
+}
+
+void feather_static(FeatherApp *app, const char *prefix, const char *root) {
+    assert(!app->frozen);
+
+    app->mounts = realloc(app->mounts, (app->mount_count + 1) * sizeof(FeatherStaticMount));
+    app->mounts[app->mount_count].prefix = sv_rstrip_char(sv_from_cstr(prefix), '/');
+    app->mounts[app->mount_count].root = sv_rstrip_char(sv_from_cstr(root), '/');
+
+    app->mount_count += 1;
+}
+
+const FeatherStaticMount *feather_find_static(const FeatherApp *app, const FeatherRequest *req, StrView *rel) {
+    if (req->method != FEATHER_GET && req->method != FEATHER_HEAD) return NULL;
+
+    StrView path = req->path;
+
+    for (size_t i = 0; i < app->mount_count; ++i) {
+        const FeatherStaticMount *mount = &app->mounts[i];
+        if (!sv_startswith(path, mount->prefix)) continue;
+
+        // "/assets" covers "/assets/x" but not "/assetsx"
+        StrView rest = sv_from_buf(path.ptr + mount->prefix.len, path.len - mount->prefix.len);
+        if (rest.len > 0 && rest.ptr[0] != '/') continue;
+
+        *rel = rest;
+        return mount;
     }
 
     return NULL;
 }
 
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+size_t feather_static_path(const FeatherStaticMount *mount, StrView rel, char *out, size_t cap) {
+    static const char index[] = "/index.html";
+
+    // Decoding only ever shrinks the path
+    if (mount->root.len + 1 + rel.len + sizeof(index) > cap) return 0;
+
+    memcpy(out, mount->root.ptr, mount->root.len);
+    size_t len = mount->root.len;
+    if (rel.len == 0 || rel.ptr[0] != '/') out[len++] = '/';
+
+    for (size_t i = 0; i < rel.len; ++i) {
+        char c = rel.ptr[i];
+
+        if (c == '%') {
+            if (i + 2 >= rel.len) return 0;
+
+            int hi = hex_value(rel.ptr[i + 1]);
+            int lo = hex_value(rel.ptr[i + 2]);
+            if (hi < 0 || lo < 0) return 0;
+
+            c = (char) (hi << 4 | lo);
+            i += 2;
+        }
+
+        if (c == '\0') return 0;
+        out[len++] = c;
+    }
+
+    // Refusing ".", ".." and empty segments keeps the result under the root
+    const char *seg = out + mount->root.len + 1;
+    const char *end = out + len;
+    while (seg <= end) {
+        const char *slash = memchr(seg, '/', end - seg);
+        if (!slash) slash = end;
+
+        size_t n = slash - seg;
+        if (n == 0 && slash != end) return 0;
+        if (n == 1 && seg[0] == '.') return 0;
+        if (n == 2 && seg[0] == '.' && seg[1] == '.') return 0;
+
+        seg = slash + 1;
+    }
+
+    if (out[len - 1] == '/') {
+        memcpy(out + len - 1, index, sizeof(index));
+        return len - 1 + sizeof(index) - 1;
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+// Decodes %XX, and '+' to a space when `plus` is set. Copies only when something
+// changes; malformed escapes are kept as they are.
+static StrView pair_decode(FeatherArena *arena, StrView raw, int plus) {
+    size_t i = 0;
+    while (i < raw.len && raw.ptr[i] != '%' && !(plus && raw.ptr[i] == '+')) ++i;
+    if (i == raw.len) return raw;
+
+    char *out = feather_arena_alloc(arena, raw.len);
+    memcpy(out, raw.ptr, i);
+    size_t len = i;
+
+    for (; i < raw.len; ++i) {
+        char c = raw.ptr[i];
+
+        if (c == '+' && plus) {
+            c = ' ';
+        } else if (c == '%' && i + 2 < raw.len && hex_value(raw.ptr[i + 1]) >= 0 && hex_value(raw.ptr[i + 2]) >= 0) {
+            c = (char) (hex_value(raw.ptr[i + 1]) << 4 | hex_value(raw.ptr[i + 2]));
+            i += 2;
+        }
+
+        out[len++] = c;
+    }
+
+    return sv_from_buf(out, len);
+}
+
+static StrView trim_spaces(StrView sv) {
+    while (sv.len > 0 && sv.ptr[0] == ' ') sv = sv_from_buf(sv.ptr + 1, sv.len - 1);
+    while (sv.len > 0 && sv.ptr[sv.len - 1] == ' ') sv.len -= 1;
+    return sv;
+}
+
+// `raw` split on `sep` into name=value pairs; cookies also lose the spaces around them
+// and the quotes around their value
+static void pair_index_build(FeatherPairIndex *index, FeatherArena *arena, StrView raw, char sep, int cookies) {
+    index->parsed = 1;
+
+    size_t cap = 1;
+    for (size_t i = 0; i < raw.len; ++i) cap += raw.ptr[i] == sep;
+    index->items = feather_arena_alloc(arena, cap * sizeof(FeatherParam));
 
-void feather_log(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+    while (raw.len > 0) {
+        const char *end = memchr(raw.ptr, sep, raw.len);
+        StrView item = sv_from_buf(raw.ptr, end ? (size_t) (end - raw.ptr) : raw.len);
+        raw = end ? sv_from_buf(end + 1, raw.len - item.len - 1) : sv_from_buf(NULL, 0);
+
+        if (cookies) item = trim_spaces(item);
+        if (item.len == 0) continue;
+
+        const char *eq = memchr(item.ptr, '=', item.len);
+        StrView key = sv_from_buf(item.ptr, eq ? (size_t) (eq - item.ptr) : item.len);
+        StrView value = eq ? sv_from_buf(eq + 1, item.len - key.len - 1) : sv_from_buf(item.ptr + item.len, 0);
+
+        if (cookies) {
+            key = trim_spaces(key);
+            value = trim_spaces(value);
+            if (value.len >= 2 && value.ptr[0] == '"' && value.ptr[value.len - 1] == '"') {
+                value = sv_from_buf(value.ptr + 1, value.len - 2);
+            }
+        }
 
-    time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
-    char buf[32];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
+        FeatherParam *pair = &index->items[index->count++];
+        pair->key = pair_decode(arena, key, !cookies);
+        pair->value = pair_decode(arena, value, !cookies);
+    }
+}
+
+static StrView pair_get(FeatherPairIndex *index, FeatherArena *arena, StrView raw, char sep, int cookies, const char *name) {
+    StrView key = sv_from_cstr(name);
 
-    printf("[%s] ", buf);
-    vprintf(fmt, args);
-    printf("\n");
+    if (index && arena) {
+        if (!index->parsed) pair_index_build(index, arena, raw, sep, cookies);
 
-    va_end(args);
+        for (size_t i = 0; i < index->count; ++i) {
+            if (sv_eq(index->items[i].key, key)) return index->items[i].value;
+        }
+        return sv_from_buf(NULL, 0);
+    }
+
+    // Nowhere to decode into, so names are matched as sent too
+    while (raw.len > 0) {
+        StrView item;
+        sv_split_once_strview(raw, sep == '&' ? "&" : ";", &item, &raw);
+        if (cookies) item = trim_spaces(item);
+
+        StrView item_key, value;
+        if (!sv_split_once_strview(item, "=", &item_key, &value)) value = sv_from_buf(item.ptr + item.len, 0);
+        if (sv_eq(cookies ? trim_spaces(item_key) : item_key, key)) return cookies ? trim_spaces(value) : value;
+    }
+    return sv_from_buf(NULL, 0);
+}
+
+StrView feather_query_get(const FeatherRequest *req, const char *name) {
+    return pair_get(req->index ? &req->index->query : NULL, req->arena, req->query, '&', 0, name);
+}
+
+StrView feather_cookie_get(const FeatherRequest *req, const char *name) {
+    return pair_get(req->index ? &req->index->cookies : NULL, req->arena, req->headers.cookie, ';', 1, name);
+}
+
+FeatherHandler feather_find_handler(const FeatherApp *app, FeatherRequest *req) {
+    const FeatherRoute *route = feather_find_route(app, req);
+    return route ? route->handler : NULL;
 }
 
 void feather_remove_header(FeatherHeaders *headers, StrView key) {
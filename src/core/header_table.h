@@ -0,0 +1,105 @@
+// Generated by tools/gen_headers.py, do not edit
+
+#define HEADER_TABLE_BITS 8
+#define HEADER_TABLE_SEED 0xBAFA03BFu
+
+// Canonical spelling of each FeatherHeaderId
+static const StrView header_names[FEATHER_HEADER_COUNT] = {
+    [FEATHER_HEADER_OTHER] = { NULL, 0 },
+    [FEATHER_HEADER_ACCEPT] = SV_LIT("Accept"),
+    [FEATHER_HEADER_ACCEPT_CHARSET] = SV_LIT("Accept-Charset"),
+    [FEATHER_HEADER_ACCEPT_ENCODING] = SV_LIT("Accept-Encoding"),
+    [FEATHER_HEADER_ACCEPT_LANGUAGE] = SV_LIT("Accept-Language"),
+    [FEATHER_HEADER_ACCEPT_RANGES] = SV_LIT("Accept-Ranges"),
+    [FEATHER_HEADER_ACCESS_CONTROL_ALLOW_CREDENTIALS] = SV_LIT("Access-Control-Allow-Credentials"),
+    [FEATHER_HEADER_ACCESS_CONTROL_ALLOW_HEADERS] = SV_LIT("Access-Control-Allow-Headers"),
+    [FEATHER_HEADER_ACCESS_CONTROL_ALLOW_METHODS] = SV_LIT("Access-Control-Allow-Methods"),
+    [FEATHER_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN] = SV_LIT("Access-Control-Allow-Origin"),
+    [FEATHER_HEADER_ACCESS_CONTROL_EXPOSE_HEADERS] = SV_LIT("Access-Control-Expose-Headers"),
+    [FEATHER_HEADER_ACCESS_CONTROL_MAX_AGE] = SV_LIT("Access-Control-Max-Age"),
+    [FEATHER_HEADER_ACCESS_CONTROL_REQUEST_HEADERS] = SV_LIT("Access-Control-Request-Headers"),
+    [FEATHER_HEADER_ACCESS_CONTROL_REQUEST_METHOD] = SV_LIT("Access-Control-Request-Method"),
+    [FEATHER_HEADER_AGE] = SV_LIT("Age"),
+    [FEATHER_HEADER_ALLOW] = SV_LIT("Allow"),
+    [FEATHER_HEADER_AUTHORIZATION] = SV_LIT("Authorization"),
+    [FEATHER_HEADER_CACHE_CONTROL] = SV_LIT("Cache-Control"),
+    [FEATHER_HEADER_CONNECTION] = SV_LIT("Connection"),
+    [FEATHER_HEADER_CONTENT_DISPOSITION] = SV_LIT("Content-Disposition"),
+    [FEATHER_HEADER_CONTENT_ENCODING] = SV_LIT("Content-Encoding"),
+    [FEATHER_HEADER_CONTENT_LANGUAGE] = SV_LIT("Content-Language"),
+    [FEATHER_HEADER_CONTENT_LENGTH] = SV_LIT("Content-Length"),
+    [FEATHER_HEADER_CONTENT_LOCATION] = SV_LIT("Content-Location"),
+    [FEATHER_HEADER_CONTENT_RANGE] = SV_LIT("Content-Range"),
+    [FEATHER_HEADER_CONTENT_SECURITY_POLICY] = SV_LIT("Content-Security-Policy"),
+    [FEATHER_HEADER_CONTENT_TYPE] = SV_LIT("Content-Type"),
+    [FEATHER_HEADER_COOKIE] = SV_LIT("Cookie"),
+    [FEATHER_HEADER_DATE] = SV_LIT("Date"),
+    [FEATHER_HEADER_DNT] = SV_LIT("DNT"),
+    [FEATHER_HEADER_ETAG] = SV_LIT("ETag"),
+    [FEATHER_HEADER_EXPECT] = SV_LIT("Expect"),
+    [FEATHER_HEADER_EXPIRES] = SV_LIT("Expires"),
+    [FEATHER_HEADER_FORWARDED] = SV_LIT("Forwarded"),
+    [FEATHER_HEADER_FROM] = SV_LIT("From"),
+    [FEATHER_HEADER_HOST] = SV_LIT("Host"),
+    [FEATHER_HEADER_IF_MATCH] = SV_LIT("If-Match"),
+    [FEATHER_HEADER_IF_MODIFIED_SINCE] = SV_LIT("If-Modified-Since"),
+    [FEATHER_HEADER_IF_NONE_MATCH] = SV_LIT("If-None-Match"),
+    [FEATHER_HEADER_IF_RANGE] = SV_LIT("If-Range"),
+    [FEATHER_HEADER_IF_UNMODIFIED_SINCE] = SV_LIT("If-Unmodified-Since"),
+    [FEATHER_HEADER_KEEP_ALIVE] = SV_LIT("Keep-Alive"),
+    [FEATHER_HEADER_LAST_MODIFIED] = SV_LIT("Last-Modified"),
+    [FEATHER_HEADER_LINK] = SV_LIT("Link"),
+    [FEATHER_HEADER_LOCATION] = SV_LIT("Location"),
+    [FEATHER_HEADER_MAX_FORWARDS] = SV_LIT("Max-Forwards"),
+    [FEATHER_HEADER_ORIGIN] = SV_LIT("Origin"),
+    [FEATHER_HEADER_PRAGMA] = SV_LIT("Pragma"),
+    [FEATHER_HEADER_PROXY_AUTHENTICATE] = SV_LIT("Proxy-Authenticate"),
+    [FEATHER_HEADER_PROXY_AUTHORIZATION] = SV_LIT("Proxy-Authorization"),
+    [FEATHER_HEADER_RANGE] = SV_LIT("Range"),
+    [FEATHER_HEADER_REFERER] = SV_LIT("Referer"),
+    [FEATHER_HEADER_RETRY_AFTER] = SV_LIT("Retry-After"),
+    [FEATHER_HEADER_SEC_FETCH_DEST] = SV_LIT("Sec-Fetch-Dest"),
+    [FEATHER_HEADER_SEC_FETCH_MODE] = SV_LIT("Sec-Fetch-Mode"),
+    [FEATHER_HEADER_SEC_FETCH_SITE] = SV_LIT("Sec-Fetch-Site"),
+    [FEATHER_HEADER_SEC_FETCH_USER] = SV_LIT("Sec-Fetch-User"),
+    [FEATHER_HEADER_SERVER] = SV_LIT("Server"),
+    [FEATHER_HEADER_SET_COOKIE] = SV_LIT("Set-Cookie"),
+    [FEATHER_HEADER_STRICT_TRANSPORT_SECURITY] = SV_LIT("Strict-Transport-Security"),
+    [FEATHER_HEADER_TE] = SV_LIT("TE"),
+    [FEATHER_HEADER_TRAILER] = SV_LIT("Trailer"),
+    [FEATHER_HEADER_TRANSFER_ENCODING] = SV_LIT("Transfer-Encoding"),
+    [FEATHER_HEADER_UPGRADE] = SV_LIT("Upgrade"),
+    [FEATHER_HEADER_UPGRADE_INSECURE_REQUESTS] = SV_LIT("Upgrade-Insecure-Requests"),
+    [FEATHER_HEADER_USER_AGENT] = SV_LIT("User-Agent"),
+    [FEATHER_HEADER_VARY] = SV_LIT("Vary"),
+    [FEATHER_HEADER_VIA] = SV_LIT("Via"),
+    [FEATHER_HEADER_WWW_AUTHENTICATE] = SV_LIT("WWW-Authenticate"),
+    [FEATHER_HEADER_X_CONTENT_TYPE_OPTIONS] = SV_LIT("X-Content-Type-Options"),
+    [FEATHER_HEADER_X_FORWARDED_FOR] = SV_LIT("X-Forwarded-For"),
+    [FEATHER_HEADER_X_FORWARDED_HOST] = SV_LIT("X-Forwarded-Host"),
+    [FEATHER_HEADER_X_FORWARDED_PROTO] = SV_LIT("X-Forwarded-Proto"),
+    [FEATHER_HEADER_X_FRAME_OPTIONS] = SV_LIT("X-Frame-Options"),
+    [FEATHER_HEADER_X_REAL_IP] = SV_LIT("X-Real-IP"),
+    [FEATHER_HEADER_X_REQUEST_ID] = SV_LIT("X-Request-Id"),
+    [FEATHER_HEADER_X_REQUESTED_WITH] = SV_LIT("X-Requested-With"),
+};
+
+// Hash slot to FeatherHeaderId, FEATHER_HEADER_OTHER where no name lands
+static const uint8_t header_slots[1 << HEADER_TABLE_BITS] = {
+     0,  0, 31,  0, 12,  0, 29,  0,  0,  0, 30,  0,  0,  0,  0,  0,
+     0,  0,  0,  0, 28,  0,  1,  0,  4, 64,  0,  0,  0, 40,  0,  0,
+     0,  0,  0,  0, 14,  0, 17,  0,  0,  0,  3,  0, 25,  0,  0,  0,
+     0,  0,  0,  0, 53, 23,  0,  0,  0,  0,  0,  0,  0, 50,  0,  0,
+     0, 24,  0,  2,  0, 10,  0,  0,  0,  0, 48,  0,  0, 21,  0,  0,
+     0, 11,  0,  0,  0,  0, 33,  0,  0,  0, 59, 72,  0,  5,  0, 20,
+    15,  0,  0,  0,  0,  0, 74,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0, 19,  6, 56,  0,  0,  0,  0,  0,  0, 46,  0, 51, 71,  0,
+    52,  0, 16,  0, 47,  0,  7,  0, 57, 62,  0, 45,  0, 60,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 34,  0,  0, 55,  0, 37,
+     0,  0,  0,  0,  0,  0,  0, 38, 58, 70, 13, 26,  8,  0, 65,  0,
+    76,  0,  0, 54,  0,  0,  0,  0,  0,  0,  0, 18, 63,  0,  0,  0,
+     0,  0, 66,  0,  0, 73,  0, 42,  0, 41,  0,  0,  0,  0,  0,  0,
+    44,  0,  0,  0, 22,  0,  0,  0,  0,  0,  0, 35, 61,  0,  0,  0,
+     0, 67,  0,  0,  0,  0, 43,  0, 39, 68,  0, 75, 36,  9,  0,  0,
+     0, 49,  0,  0,  0,  0,  0,  0, 32,  0,  0,  0, 27,  0, 69,  0,
+};
@@ -0,0 +1,160 @@
+#include "feather.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+void feather_scan_reset(FeatherScan *scan) {
+    scan->line_count = 0;
+    scan->pos = 0;
+    scan->line_start = 0;
+    scan->colon = FEATHER_NO_COLON;
+    scan->header_end = 0;
+    scan->truncated = 0;
+}
+
+// Handles one LF or ':' found at `i`. Returns 1 once the blank line is reached.
+static inline int scan_hit(FeatherScan *scan, const char *buf, size_t i) {
+    if (buf[i] == ':') {
+        if (scan->colon == FEATHER_NO_COLON) scan->colon = (uint32_t) (i - scan->line_start);
+        return 0;
+    }
+
+    size_t end = i;
+    if (end > scan->line_start && buf[end - 1] == '\r') end -= 1;
+
+    if (end == scan->line_start) {
+        // Empty lines before the request line are skipped (RFC 9112 section 2.2)
+        if (scan->line_count == 0) {
+            scan->line_start = i + 1;
+            scan->colon = FEATHER_NO_COLON;
+            return 0;
+        }
+
+        scan->header_end = i + 1;
+        scan->pos = i + 1;
+        return 1;
+    }
+
+    // Past the limit lines are dropped, but we still look for the end of the headers.
+    // The head is flagged since a dropped line could have framed the body.
+    if (scan->line_count < FEATHER_MAX_HEADER_LINES) {
+        FeatherLine *line = &scan->lines[scan->line_count++];
+        line->start = (uint32_t) scan->line_start;
+        line->len = (uint32_t) (end - scan->line_start);
+        line->colon = scan->colon;
+    } else {
+        scan->truncated = 1;
+    }
+
+    scan->line_start = i + 1;
+    scan->colon = FEATHER_NO_COLON;
+    return 0;
+}
+
+// Walks the set bits of a block mask in order; `base` is the offset of bit 0
+#define SCAN_MASK(mask, base) \
+    do { \
+        while (mask) { \
+            size_t i_ = (base) + (size_t) __builtin_ctzll(mask); \
+            mask &= mask - 1; \
+            if (scan_hit(scan, buf, i_)) return 1; \
+        } \
+    } while (0)
+
+int feather_scan_request(FeatherScan *scan, const char *buf, size_t len) {
+    if (scan->header_end) return 1;
+
+    size_t i = scan->pos;
+
+#if defined(__AVX2__)
+    const __m256i lf32 = _mm256_set1_epi8('\n');
+    const __m256i colon32 = _mm256_set1_epi8(':');
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (buf + i));
+        uint64_t mask = (uint32_t) _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, lf32), _mm256_cmpeq_epi8(block, colon32))
+        );
+        SCAN_MASK(mask, i);
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i lf16 = _mm_set1_epi8('\n');
+    const __m128i colon16 = _mm_set1_epi8(':');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (buf + i));
+        uint64_t mask = (uint32_t) _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, lf16), _mm_cmpeq_epi8(block, colon16))
+        );
+        SCAN_MASK(mask, i);
+    }
+#endif
+
+    for (; i < len; ++i) {
+        if ((buf[i] == '\n' || buf[i] == ':') && scan_hit(scan, buf, i)) return 1;
+    }
+
+    scan->pos = len;
+    return 0;
+}
+
+#undef SCAN_MASK
+
+// Routes and static files only see the path; the query is decoded on demand
+static inline void split_query(FeatherRequest *req) {
+    const char *mark = memchr(req->path.ptr, '?', req->path.len);
+    if (!mark) return;
+
+    req->query = sv_from_buf(mark + 1, req->path.len - (mark + 1 - req->path.ptr));
+    req->path.len = mark - req->path.ptr;
+}
+
+int feather_parse_scanned(FeatherRequest *req, const char *buf, const FeatherScan *scan) {
+    if (scan->line_count == 0) return 0;
+
+    const FeatherLine *line = &scan->lines[0];
+    StrView rest = sv_from_buf(buf + line->start, line->len);
+
+    // Without a method and a target there's no request line to speak of
+    const char *space = memchr(rest.ptr, ' ', rest.len);
+    if (!space || space == rest.ptr || space + 1 == rest.ptr + rest.len || space[1] == ' ') {
+        req->method = FEATHER_UNKNOWN;
+        return 0;
+    }
+
+    req->method = feather_sv_to_method(sv_from_buf(rest.ptr, space - rest.ptr));
+    rest = sv_from_buf(space + 1, rest.len - (space + 1 - rest.ptr));
+
+    space = memchr(rest.ptr, ' ', rest.len);
+    if (!space) {
+        req->path = rest;
+        split_query(req);
+        return 1;
+    }
+
+    req->path = sv_from_buf(rest.ptr, space - rest.ptr);
+    split_query(req);
+    if (space + 1 == rest.ptr + rest.len) return 1;
+
+    for (size_t i = 1; i < scan->line_count; ++i) {
+        line = &scan->lines[i];
+        if (line->colon == FEATHER_NO_COLON) continue;
+
+        StrView key = sv_from_buf(buf + line->start, line->colon);
+        StrView value = sv_from_buf(key.ptr + line->colon + 1, line->len - line->colon - 1);
+
+        while (value.len > 0 && value.ptr[0] == ' ') {
+            value.ptr += 1;
+            value.len -= 1;
+        }
+
+        feather_set_header(&req->headers, key, value);
+    }
+
+    return 1;
+}
@@ -1,25 +1,171 @@
+#define _GNU_SOURCE
+
 #include "coro.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <threads.h>
-#include <ucontext.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <errno.h>
-#include <sys/timerfd.h>
+#include <string.h>
 #include <unistd.h>
 #include "dyn_arr.h"
+#include "uring.h"
+#include "trace.h"
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 
-thread_local static ucontext_t main_ctx;
+thread_local static CoroContext main_ctx;
+thread_local static Coro *current = NULL;
 thread_local static DynArr(Coro *) ready_coros = {0};
 thread_local static DynArr(Coro *) finished_coros = {0};
 thread_local static size_t sleeping_coros_count = 0;
 thread_local static int epoll_fd;
+thread_local static TimerWheel timers;
+// Deadlines of hibernated fds, kept apart since they wake no coroutine
+thread_local static TimerWheel idle_timers;
+thread_local static size_t idle_count = 0;
+#ifndef FEATHER_NO_URING
+thread_local static int use_uring = 0;
+#endif
+
+static CoroBackend backend = CORO_BACKEND_AUTO;
+
+// Only this thread writes its stats; relaxed atomics keep scrapes from reading torn values
+thread_local static CoroStats stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static DynArr(CoroStats *) all_stats = {0};
+
+#define STAT_SET(field, value) __atomic_store_n(&stats.field, (value), __ATOMIC_RELAXED)
+#define STAT_ADD(field, value) STAT_SET(field, stats.field + (value))
+
+// Chase-Lev deque: the owning worker pushes and pops at the bottom, thieves take
+// from the top. Fixed size; when it's full the owner keeps the coroutine local.
+typedef struct {
+    long top;
+    long bottom;
+    Coro *items[CORO_DEQUE_SIZE];
+} CoroDeque;
+
+typedef struct {
+    CoroDeque deque;
+    int wake_fd;
+    int idle;
+} CoroWorker;
+
+static CoroWorker *workers = NULL;
+static int worker_count = 0;
+static int workers_started = 0;
+static int idle_workers = 0;
+thread_local static CoroWorker *self = NULL;
+thread_local static unsigned steal_seed = 0;
+
+static size_t stack_size = CORO_STACK_SIZE;
+static size_t page_size;
+
+void coro_set_stack_size(size_t size) {
+    if (!page_size) page_size = sysconf(_SC_PAGESIZE);
+    if (size < CORO_MIN_STACK_SIZE) size = CORO_MIN_STACK_SIZE;
+
+    stack_size = (size + page_size - 1) & ~(page_size - 1);
+}
+
+// Stacks are mapped with a PROT_NONE guard page below them, so an overflow faults
+// instead of corrupting the neighbour. Pages are only committed once they're touched.
+static void *stack_alloc(size_t size) {
+    if (!page_size) page_size = sysconf(_SC_PAGESIZE);
+
+    char *base = mmap(
+        NULL, size + page_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+        -1, 0
+    );
+
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+
+    if (mprotect(base, page_size, PROT_NONE) < 0) {
+        perror("mprotect");
+        exit(1);
+    }
+
+    return base + page_size;
+}
+
+static void stack_free(void *stack, size_t size) {
+    munmap((char *) stack - page_size, size + page_size);
+}
 
 void coro_destroy(Coro *coro) {
-    free(coro->stack);
+    stack_free(coro->stack, coro->stack_size);
+}
+
+static void coro_recycle(Coro *coro) {
+    if (finished_coros.size >= CORO_POOL_HIGH_WATER) {
+        madvise(coro->stack, coro->stack_size, MADV_FREE);
+    }
+
+    darr_push(&finished_coros, coro);
+}
+
+static void coro_trampoline(uintptr_t ptr);
+
+#ifdef CORO_UCONTEXT
+
+#define coro_switch(from, to) swapcontext(from, to)
+
+static void coro_context_init(Coro *coro) {
+    getcontext(&coro->ctx);
+    coro->ctx.uc_stack.ss_sp = coro->stack;
+    coro->ctx.uc_stack.ss_size = coro->stack_size;
+    coro->ctx.uc_link = &main_ctx;
+    makecontext(&coro->ctx, (void (*)(void)) coro_trampoline, 1, (uintptr_t) coro);
+}
+
+#else
+
+// Defined in coro_switch.S
+void coro_switch(CoroContext *from, CoroContext *to);
+void coro_boot(void);
+
+// Lays out a frame that coro_switch can "return" into: the saved registers it pops,
+// followed by coro_boot as the return address. coro_boot then calls the trampoline
+// with the argument stashed in a callee-saved register.
+static void coro_context_init(Coro *coro) {
+    uintptr_t top = ((uintptr_t) coro->stack + coro->stack_size) & ~(uintptr_t) 15;
+    uint64_t *sp = (uint64_t *) top;
+
+#if defined(__x86_64__)
+    *--sp = (uint64_t) coro_boot;
+    *--sp = 0;                              // rbp
+    *--sp = 0;                              // rbx
+    *--sp = (uint64_t) coro;                // r12
+    *--sp = (uint64_t) coro_trampoline;     // r13
+    *--sp = 0;                              // r14
+    *--sp = 0;                              // r15
+    *--sp = 0x037FULL << 32 | 0x1F80;       // x87 control word, mxcsr
+#elif defined(__aarch64__)
+    sp -= 20;
+    memset(sp, 0, 20 * sizeof(uint64_t));
+    sp[0] = (uint64_t) coro;                // x19
+    sp[1] = (uint64_t) coro_trampoline;     // x20
+    sp[11] = (uint64_t) coro_boot;          // x30
+#endif
+
+    coro->ctx.sp = sp;
 }
 
+#endif
+
 static void coro_trampoline(uintptr_t ptr) {
     Coro *coro = (Coro *) ptr;
     coro->state = CORO_RUNNING;
@@ -27,22 +173,19 @@ static void coro_trampoline(uintptr_t ptr) {
     coro->entry.func(coro->entry.arg);
 
     coro->state = CORO_FINISHED;
-    darr_push(&finished_coros, coro);
 
-    setcontext(&main_ctx);
+    coro_switch(&coro->ctx, &main_ctx);
 }
 
 static void coro_reset(Coro *coro, void (*func)(void *), void *arg) {
-    coro->waiting_events = 0;
-    coro->waiting_fd = -1;
     coro->state = CORO_READY;
+    coro->wait_timer = NULL;
+    coro->migratable = 0;
+    coro->trace_id = 0;
+    coro->idle_deadline = CORO_NO_DEADLINE;
     coro->entry.func = func;
     coro->entry.arg = arg;
-    getcontext(&coro->ctx);
-    coro->ctx.uc_stack.ss_sp = coro->stack;
-    coro->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
-    coro->ctx.uc_link = &main_ctx;
-    makecontext(&coro->ctx, (void (*)(void)) coro_trampoline, 1, (uintptr_t) coro);
+    coro_context_init(coro);
 }
 
 Coro *coro_spawn(void (*func)(void *), void *arg) {
@@ -50,9 +193,16 @@ Coro *coro_spawn(void (*func)(void *), void *arg) {
     if (finished_coros.size > 0) {
         coro = finished_coros.items[finished_coros.size - 1]; 
         darr_pop(&finished_coros);
+
+        if (coro->stack_size != stack_size) {
+            stack_free(coro->stack, coro->stack_size);
+            coro->stack = stack_alloc(stack_size);
+            coro->stack_size = stack_size;
+        }
     } else {
         coro = (Coro *) malloc(sizeof(Coro));
-        coro->stack = malloc(CORO_STACK_SIZE);
+        coro->stack = stack_alloc(stack_size);
+        coro->stack_size = stack_size;
     }
 
     coro_reset(coro, func, arg);
@@ -61,109 +211,851 @@ Coro *coro_spawn(void (*func)(void *), void *arg) {
     return coro;
 }
 
+static int deque_push(CoroDeque *d, Coro *coro) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= CORO_DEQUE_SIZE) return 0;
+
+    __atomic_store_n(&d->items[b & (CORO_DEQUE_SIZE - 1)], coro, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static Coro *deque_pop(CoroDeque *d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    Coro *coro = __atomic_load_n(&d->items[b & (CORO_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        // Last one left, race the thieves for it
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) coro = NULL;
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return coro;
+}
+
+static Coro *deque_steal(CoroDeque *d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+
+    Coro *coro = __atomic_load_n(&d->items[t & (CORO_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return NULL;
+
+    return coro;
+}
+
+static Coro *coro_steal(void) {
+    steal_seed = steal_seed * 1103515245 + 12345;
+    int start = (int) ((steal_seed >> 16) % (unsigned) worker_count);
+
+    for (int i = 0; i < worker_count; ++i) {
+        CoroWorker *victim = &workers[(start + i) % worker_count];
+        if (victim == self) continue;
+
+        Coro *coro = deque_steal(&victim->deque);
+        if (coro) return coro;
+    }
+
+    return NULL;
+}
+
+// Hands new work to one sleeping worker, if there is any
+static void notify_idle(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&idle_workers, __ATOMIC_RELAXED)) return;
+
+    for (int i = 0; i < worker_count; ++i) {
+        int idle = 1;
+        if (__atomic_compare_exchange_n(&workers[i].idle, &idle, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            eventfd_write(workers[i].wake_fd, 1);
+            return;
+        }
+    }
+}
+
+void coro_set_work_stealing(int count) {
+    workers = calloc((size_t) count, sizeof(CoroWorker));
+    for (int i = 0; i < count; ++i) {
+        workers[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (workers[i].wake_fd < 0) {
+            perror("eventfd");
+            exit(1);
+        }
+    }
+
+    worker_count = count;
+}
+
+int coro_set_migratable(int migratable) {
+    int previous = current->migratable;
+    current->migratable = migratable;
+    return previous;
+}
+
 void coro_yield(void) {
-    Coro *coro = ready_coros.items[0];
+    Coro *coro = current;
     coro->state = CORO_SUSPENDED;
-    swapcontext(&coro->ctx, &main_ctx);
+    coro_switch(&coro->ctx, &main_ctx);
 }
 
-void coro_sleep_fd(int fd, int events) {
-    if (fd < 0) {
-        coro_yield();
+Coro *coro_current(void) {
+    return current;
+}
+
+void coro_set_trace(uint64_t id) {
+    current->trace_id = id;
+}
+
+void coro_park(void) {
+    Coro *coro = current;
+    if (coro->trace_id) coro->parked_ns = trace_now_ns();
+    coro->state = CORO_SLEEPING;
+    sleeping_coros_count += 1;
+    coro_switch(&coro->ctx, &main_ctx);
+}
+
+// Wakeups always come from the worker the coroutine parked on. Its wait timer is
+// cancelled here, on the wheel it was added to, so that nothing on this worker
+// still points at the coroutine if someone else steals it.
+static void coro_wake_to(Coro *coro, int stealable) {
+    if (coro->state != CORO_SLEEPING) return;
+
+    if (coro->wait_timer) {
+        timer_wheel_cancel(&timers, coro->wait_timer);
+        coro->wait_timer = NULL;
+    }
+
+    coro->state = CORO_READY;
+    sleeping_coros_count -= 1;
+
+    if (coro->trace_id) trace_span(coro->trace_id, TRACE_PARK, coro->parked_ns, trace_now_ns(), NULL, 0, 0);
+
+    if (stealable && self && coro->migratable && deque_push(&self->deque, coro)) {
+        notify_idle();
         return;
     }
 
-    Coro *coro = ready_coros.items[0];
-    coro->state = CORO_SLEEPING;
-    coro->waiting_fd = fd;
-    coro->waiting_events = events;
+    darr_push(&ready_coros, coro);
+}
 
-    sleeping_coros_count += 1;
+// A coroutine can be due for more than one reason at once, e.g. its fd became ready
+// in the same loop iteration its deadline passed. Only the first wakeup counts.
+void coro_wake(Coro *coro) {
+    coro_wake_to(coro, 1);
+}
+
+// A timed-out wait may still be registered with the fd or the ring, so the
+// coroutine has to clean that up on this worker before it can move
+static void coro_timer_fire(Timer *timer) {
+    Coro *coro = (Coro *) timer->data;
+    coro->wait_timer = NULL;
+    coro_wake_to(coro, 0);
+}
+
+void coro_timer_add(Timer *timer, uint64_t deadline) {
+    timer_wheel_add(&timers, timer, deadline, current);
+    current->wait_timer = timer;
+}
+
+void coro_timer_cancel(Timer *timer) {
+    if (!timer_pending(timer)) return;
+
+    timer_wheel_cancel(&timers, timer);
+    current->wait_timer = NULL;
+}
+
+uint64_t coro_deadline(int timeout_ms) {
+    return timeout_ms < 0 ? CORO_NO_DEADLINE : timer_now_ms() + (uint64_t) timeout_ms;
+}
+
+void coro_set_backend(CoroBackend b) {
+    backend = b;
+}
+
+// Registration of an fd with the epoll instance of the worker that waits on it. Every fd
+// is added once, edge-triggered for both directions, and stays registered until
+// coro_close; a reader and a writer can wait on the same fd at once. When a coroutine
+// that was stolen waits on the fd, it is moved over to the new worker's instance.
+typedef struct CoroIdle CoroIdle;
+
+typedef struct {
+    Coro *reader;
+    Coro *writer;
+    CoroIdle *idle;
+    int epoll_fd;
+    int registered;
+    int lock;
+} FdSlot;
+
+#define FD_CHUNK_SIZE 4096
+#define FD_CHUNK_COUNT 1024
 
+// fds are shared by all workers, so the table is too. Chunks are allocated on first
+// use; a slot is only touched by the worker that owns the fd, except right after the
+// fd moved, when its old worker may still be handling events it fetched before. The
+// lock only guards that, so it is skipped unless work stealing is on.
+static FdSlot *fd_chunks[FD_CHUNK_COUNT];
+
+static FdSlot *fd_slot(int fd) {
+    size_t chunk = (size_t) fd / FD_CHUNK_SIZE;
+    if (chunk >= FD_CHUNK_COUNT) {
+        fprintf(stderr, "fd %d is out of range for the fd table\n", fd);
+        exit(1);
+    }
+
+    FdSlot *slots = __atomic_load_n(&fd_chunks[chunk], __ATOMIC_ACQUIRE);
+    if (!slots) {
+        FdSlot *fresh = calloc(FD_CHUNK_SIZE, sizeof(FdSlot));
+        if (__atomic_compare_exchange_n(&fd_chunks[chunk], &slots, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            slots = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+
+    return &slots[fd % FD_CHUNK_SIZE];
+}
+
+static void slot_lock(FdSlot *slot) {
+    if (!worker_count) return;
+
+    while (__atomic_exchange_n(&slot->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED)) {}
+    }
+}
+
+static void slot_unlock(FdSlot *slot) {
+    if (!worker_count) return;
+
+    __atomic_store_n(&slot->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void slot_reset(FdSlot *slot) {
+    slot_lock(slot);
+    slot->reader = NULL;
+    slot->writer = NULL;
+    slot->idle = NULL;
+    slot->registered = 0;
+    slot_unlock(slot);
+}
+
+static int fd_register(int fd, FdSlot *slot) {
     struct epoll_event ev = {
-        .events = events,
-        .data.ptr = coro
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.fd = fd
     };
 
+    // Registered with another worker that ran the coroutine before it was stolen
+    if (slot->registered && slot->epoll_fd != epoll_fd) {
+        epoll_ctl(slot->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        slot->registered = 0;
+    }
+
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-        if (errno == EEXIST) {
-            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
-        } else {
+        if (errno != EEXIST) {
             perror("epoll_ctl");
             exit(1);
         }
+
+        return 0;
     }
 
-    swapcontext(&coro->ctx, &main_ctx);
+    slot->registered = 1;
+    slot->epoll_fd = epoll_fd;
+    return 1;
 }
 
-void coro_sleep_ms(int ms) {
-    if (ms <= 0) {
+// Only valid once the fd returned EAGAIN: with edge triggering, readiness that was
+// already there before we started waiting is never reported again.
+// Returns 0 if the deadline passed before the fd became ready.
+static int coro_wait_fd(int fd, int events, uint64_t deadline) {
+    FdSlot *slot = fd_slot(fd);
+    Coro *coro = current;
+
+    slot_lock(slot);
+    if (!slot->registered || slot->epoll_fd != epoll_fd) fd_register(fd, slot);
+    if (events & EPOLLOUT) slot->writer = coro;
+    if (events & ~EPOLLOUT) slot->reader = coro;
+    slot_unlock(slot);
+
+    Timer timer = {0};
+    if (deadline != CORO_NO_DEADLINE) coro_timer_add(&timer, deadline);
+
+    coro_park();
+
+    // fd_wake takes us out of the slot, so still being there means the timer fired
+    slot_lock(slot);
+    int ready = slot->reader != coro && slot->writer != coro;
+    if (slot->reader == coro) slot->reader = NULL;
+    if (slot->writer == coro) slot->writer = NULL;
+    slot_unlock(slot);
+
+    coro_timer_cancel(&timer);
+    return ready;
+}
+
+// All a hibernated fd costs: the entry to start once it's readable and its deadline
+struct CoroIdle {
+    int fd;
+    CoroEntry entry;
+    uint64_t deadline;
+    Timer timer;
+#ifndef FEATHER_NO_URING
+    void *poll;
+    int expired;
+#endif
+};
+
+static void idle_free(CoroIdle *idle) {
+    idle_count -= 1;
+    free(idle);
+}
+
+static void idle_resume(CoroIdle *idle) {
+    if (timer_pending(&idle->timer)) timer_wheel_cancel(&idle_timers, &idle->timer);
+
+    Coro *coro = coro_spawn(idle->entry.func, idle->entry.arg);
+    coro->idle_deadline = idle->deadline;
+    idle_free(idle);
+}
+
+#ifndef FEATHER_NO_URING
+static void idle_polled(void *arg, int res) {
+    (void) res;
+    CoroIdle *idle = arg;
+
+    // Anything but a readable fd is left for the resumed coroutine to find out about
+    if (!idle->expired) {
+        idle_resume(idle);
+        return;
+    }
+
+    close(idle->fd);
+    idle_free(idle);
+}
+#endif
+
+static void idle_expire(Timer *timer) {
+    CoroIdle *idle = timer->data;
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) {
+        // The poll still refers to the record, which goes once the cancellation completes
+        idle->expired = 1;
+        uring_cancel(idle->poll);
+        return;
+    }
+#endif
+
+    // What coro_close does; resetting the slot drops the idle record from it too
+    slot_reset(fd_slot(idle->fd));
+    close(idle->fd);
+    idle_free(idle);
+}
+
+void coro_hibernate(int fd, uint64_t deadline, void (*func)(void *), void *arg) {
+    CoroIdle *idle = calloc(1, sizeof(CoroIdle));
+    idle->fd = fd;
+    idle->entry.func = func;
+    idle->entry.arg = arg;
+    idle->deadline = deadline;
+    idle_count += 1;
+
+    if (deadline != CORO_NO_DEADLINE) timer_wheel_add(&idle_timers, &idle->timer, deadline, idle);
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) {
+        idle->poll = uring_poll_callback(fd, POLLIN, idle_polled, idle);
+        return;
+    }
+#endif
+
+    FdSlot *slot = fd_slot(fd);
+    slot_lock(slot);
+    if (!slot->registered || slot->epoll_fd != epoll_fd) fd_register(fd, slot);
+    slot->idle = idle;
+    slot_unlock(slot);
+
+    // An edge that arrived while the fd had no waiter is never reported again
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) <= 0) return;
+
+    slot_lock(slot);
+    slot->idle = NULL;
+    slot_unlock(slot);
+
+    idle_resume(idle);
+}
+
+uint64_t coro_idle_deadline(void) {
+    return current->idle_deadline;
+}
+
+static void fd_wake(int fd, uint32_t events) {
+    FdSlot *slot = fd_slot(fd);
+    Coro *reader = NULL, *writer = NULL;
+    CoroIdle *idle = NULL;
+
+    slot_lock(slot);
+
+    // A leftover event from before the fd moved to another worker
+    if (slot->epoll_fd != epoll_fd) {
+        slot_unlock(slot);
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && slot->reader) {
+        reader = slot->reader;
+        slot->reader = NULL;
+        if (slot->writer == reader) slot->writer = NULL;
+    }
+
+    if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && slot->writer) {
+        writer = slot->writer;
+        slot->writer = NULL;
+        if (slot->reader == writer) slot->reader = NULL;
+    }
+
+    if ((events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && slot->idle) {
+        idle = slot->idle;
+        slot->idle = NULL;
+    }
+
+    slot_unlock(slot);
+
+    if (idle) idle_resume(idle);
+    if (reader) coro_wake(reader);
+    if (writer) coro_wake(writer);
+}
+
+
+int coro_sleep_fd_timeout(int fd, int events, int ms) {
+    if (fd < 0) {
+        coro_sleep_ms(ms);
+        return 0;
+    }
+
+    uint64_t deadline = coro_deadline(ms);
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) {
+        if (uring_poll(fd, events, deadline) >= 0) return 1;
+        return errno == ETIMEDOUT ? 0 : -1;
+    }
+#endif
+
+    // Callers of this may not have seen EAGAIN, and may have closed and reused the fd
+    // behind our back, so re-add it. A fresh registration reports the current state;
+    // for an existing one the level has to be checked by hand.
+    FdSlot *slot = fd_slot(fd);
+    slot_lock(slot);
+    int fresh = fd_register(fd, slot);
+    slot_unlock(slot);
+
+    if (!fresh) {
+        struct pollfd pfd = { .fd = fd, .events = (short) events };
+        if (poll(&pfd, 1, 0) > 0) return 1;
+    }
+
+    return coro_wait_fd(fd, events, deadline);
+}
+
+void coro_sleep_fd(int fd, int events) {
+    if (fd < 0) {
         coro_yield();
         return;
     }
 
-    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    coro_sleep_fd_timeout(fd, events, -1);
+}
+
+int coro_close(int fd) {
+#ifndef FEATHER_NO_URING
+    if (use_uring) return close(fd);
+#endif
 
-    struct itimerspec its = {0};
-    its.it_value.tv_sec = ms / 1000;
-    its.it_value.tv_nsec = (ms % 1000) * 1000000;
+    slot_reset(fd_slot(fd));
 
-    if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
-        close(tfd);
+    // Closing the last reference also drops it from the epoll set
+    return close(fd);
+}
+
+void coro_sleep_ms(int ms) {
+    if (ms <= 0) {
         coro_yield();
         return;
     }
 
-    coro_sleep_fd(tfd, EPOLLIN);
-    int a;
-    read(tfd, &a, 4);
-    close(tfd);
+    Timer timer = {0};
+    coro_timer_add(&timer, coro_deadline(ms));
+
+    while (timer_pending(&timer)) {
+        coro_park();
+    }
+}
+
+int coro_accept(int sfd) {
+#ifndef FEATHER_NO_URING
+    if (use_uring) return uring_accept(sfd);
+#endif
+
+    while (1) {
+        int cfd = accept4(sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd >= 0) {
+            // The number may have belonged to an fd that was closed without coro_close
+            slot_reset(fd_slot(cfd));
+            return cfd;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return cfd;
+
+        coro_wait_fd(sfd, EPOLLIN, CORO_NO_DEADLINE);
+    }
+}
+
+ssize_t coro_recv(int fd, void *buf, size_t len, int timeout_ms) {
+    uint64_t deadline = coro_deadline(timeout_ms);
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) return uring_recv(fd, buf, len, deadline);
+#endif
+
+    while (1) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+
+        if (!coro_wait_fd(fd, EPOLLIN, deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+ssize_t coro_send(int fd, const void *buf, size_t len, int flags, int timeout_ms) {
+    uint64_t deadline = coro_deadline(timeout_ms);
+    flags |= MSG_NOSIGNAL;
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) return uring_send(fd, buf, len, flags, deadline);
+#endif
+
+    while (1) {
+        ssize_t n = send(fd, buf, len, flags);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+
+        if (!coro_wait_fd(fd, EPOLLOUT, deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+ssize_t coro_sendv(int fd, const struct iovec *iov, int iovcnt, int flags, int timeout_ms) {
+    uint64_t deadline = coro_deadline(timeout_ms);
+    struct msghdr msg = { .msg_iov = (struct iovec *) iov, .msg_iovlen = (size_t) iovcnt };
+    flags |= MSG_NOSIGNAL;
+
+#ifndef FEATHER_NO_URING
+    if (use_uring) return uring_sendmsg(fd, &msg, flags, deadline);
+#endif
+
+    while (1) {
+        ssize_t n = sendmsg(fd, &msg, flags);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+
+        if (!coro_wait_fd(fd, EPOLLOUT, deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+ssize_t coro_sendfile(int out_fd, int in_fd, off_t *offset, size_t count, int timeout_ms) {
+    uint64_t deadline = coro_deadline(timeout_ms);
+    size_t sent = 0;
+    int failed = 0;
+
+#ifndef FEATHER_NO_URING
+    // There is no sendfile op, and ring sockets are blocking so sends can be queued on
+    // them. Make this one non-blocking for the duration and wait for it with polls.
+    int fl = use_uring ? fcntl(out_fd, F_GETFL) : -1;
+    int toggled = fl != -1 && !(fl & O_NONBLOCK);
+    if (toggled) fcntl(out_fd, F_SETFL, fl | O_NONBLOCK);
+#endif
+
+    while (sent < count) {
+        ssize_t n = sendfile(out_fd, in_fd, offset, count - sent);
+        if (n == 0) break;
+
+        if (n > 0) {
+            sent += (size_t) n;
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            failed = 1;
+            break;
+        }
+
+#ifndef FEATHER_NO_URING
+        if (use_uring) {
+            if (uring_poll(out_fd, POLLOUT, deadline) < 0) {
+                failed = 1;
+                break;
+            }
+            continue;
+        }
+#endif
+
+        if (!coro_wait_fd(out_fd, EPOLLOUT, deadline)) {
+            errno = ETIMEDOUT;
+            failed = 1;
+            break;
+        }
+    }
+
+#ifndef FEATHER_NO_URING
+    if (toggled) {
+        int err = errno;
+        fcntl(out_fd, F_SETFL, fl);
+        errno = err;
+    }
+#endif
+
+    return failed ? -1 : (ssize_t) sent;
+}
+
+static Coro *next_runnable(void) {
+    if (self) {
+        Coro *coro = deque_pop(&self->deque);
+        if (coro) return coro;
+    }
+
+    if (ready_coros.size > 0) {
+        Coro *coro = ready_coros.items[0];
+        ready_coros.items[0] = ready_coros.items[ready_coros.size - 1];
+        ready_coros.size -= 1;
+        return coro;
+    }
+
+    return NULL;
+}
+
+static void coro_run(Coro *coro) {
+    current = coro;
+    coro->state = CORO_RUNNING;
+    coro_switch(&main_ctx, &coro->ctx);
+    current = NULL;
+
+    if (coro->state == CORO_FINISHED) {
+        coro_recycle(coro);
+    } else if (coro->state != CORO_SLEEPING) {
+        coro->state = CORO_READY;
+        darr_push(&ready_coros, coro);
+    }
+}
+
+// Announces that this worker is about to block. Checking for work once more
+// afterwards pairs with notify_idle so a push in between can't be missed.
+static Coro *worker_idle(void) {
+    __atomic_store_n(&self->idle, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+
+    Coro *coro = coro_steal();
+    if (coro) {
+        __atomic_store_n(&self->idle, 0, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return coro;
+}
+
+static void worker_busy(void) {
+    __atomic_store_n(&self->idle, 0, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+size_t coro_stats(CoroStats *out, size_t cap) {
+    pthread_mutex_lock(&stats_lock);
+
+    for (size_t i = 0; i < all_stats.size && i < cap; ++i) {
+        const CoroStats *src = all_stats.items[i];
+        out[i] = (CoroStats) {
+            .ready = __atomic_load_n(&src->ready, __ATOMIC_RELAXED),
+            .sleeping = __atomic_load_n(&src->sleeping, __ATOMIC_RELAXED),
+            .hibernated = __atomic_load_n(&src->hibernated, __ATOMIC_RELAXED),
+            .polls = __atomic_load_n(&src->polls, __ATOMIC_RELAXED),
+            .events = __atomic_load_n(&src->events, __ATOMIC_RELAXED),
+            .last_batch = __atomic_load_n(&src->last_batch, __ATOMIC_RELAXED),
+            .lag_us = __atomic_load_n(&src->lag_us, __ATOMIC_RELAXED),
+            .busy_us = __atomic_load_n(&src->busy_us, __ATOMIC_RELAXED),
+        };
+    }
+
+    size_t count = all_stats.size;
+    pthread_mutex_unlock(&stats_lock);
+    return count;
+}
+
+static void stats_register(int add) {
+    pthread_mutex_lock(&stats_lock);
+
+    if (add) {
+        darr_push(&all_stats, &stats);
+    } else {
+        for (size_t i = 0; i < all_stats.size; ++i) {
+            if (all_stats.items[i] == &stats) {
+                all_stats.items[i] = all_stats.items[--all_stats.size];
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// Once per poll: how long the pass before it took, and what the poll brought in
+static void stats_poll(uint64_t pass_start, uint64_t poll_start, int batch) {
+    STAT_SET(lag_us, poll_start - pass_start);
+    STAT_ADD(busy_us, poll_start - pass_start);
+    STAT_ADD(polls, 1);
+    STAT_ADD(events, (uint64_t) (batch > 0 ? batch : 0));
+    STAT_SET(last_batch, (uint64_t) (batch > 0 ? batch : 0));
+
+    uint64_t ready = ready_coros.size;
+    if (self) {
+        long depth = __atomic_load_n(&self->deque.bottom, __ATOMIC_RELAXED) - __atomic_load_n(&self->deque.top, __ATOMIC_RELAXED);
+        if (depth > 0) ready += (uint64_t) depth;
+    }
+
+    STAT_SET(ready, ready);
+    STAT_SET(sleeping, sleeping_coros_count);
+    STAT_SET(hibernated, idle_count);
+}
+
+static void timers_advance(void) {
+    uint64_t now = timer_now_ms();
+    timer_wheel_advance(&timers, now, coro_timer_fire);
+    timer_wheel_advance(&idle_timers, now, idle_expire);
 }
 
 void coro_start(void) {
-    getcontext(&main_ctx);
+#ifndef FEATHER_NO_URING
+    use_uring = backend != CORO_BACKEND_EPOLL && uring_init() == 0;
+    if (!use_uring && backend == CORO_BACKEND_URING) {
+        fprintf(stderr, "io_uring is unavailable, falling back to epoll\n");
+    }
+#endif
 
     epoll_fd = epoll_create1(0);
     struct epoll_event events[64];
+    timer_wheel_init(&timers, timer_now_ms());
+    timer_wheel_init(&idle_timers, timer_now_ms());
 
-    while (ready_coros.size > 0 || sleeping_coros_count > 0) {
-        while (ready_coros.size > 0) {
-            Coro *coro = ready_coros.items[0];
+    if (worker_count) {
+        int id = __atomic_fetch_add(&workers_started, 1, __ATOMIC_RELAXED);
+        if (id < worker_count) {
+            self = &workers[id];
+            steal_seed = (unsigned) id;
 
-            coro->state = CORO_RUNNING;
-            swapcontext(&main_ctx, &coro->ctx);
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.fd = self->wake_fd };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, self->wake_fd, &ev);
+        }
+    }
 
-            if (coro->state == CORO_FINISHED || coro->state == CORO_SLEEPING) {
-                ready_coros.items[0] = ready_coros.items[ready_coros.size - 1];
-                ready_coros.size -= 1;
-            }
+    stats = (CoroStats) {0};
+    stats_register(1);
+    uint64_t pass_start = now_us();
 
-            else {
-                ready_coros.items[0] = ready_coros.items[ready_coros.size - 1];
-                ready_coros.items[ready_coros.size - 1] = coro;
+    while (ready_coros.size > 0 || sleeping_coros_count > 0 || idle_count > 0 || self) {
+        Coro *coro;
+        while ((coro = next_runnable())) {
+            coro_run(coro);
+        }
+
+        if (!sleeping_coros_count && !idle_count && !self) continue;
+
+        // Only once there's nothing local left, and a batch at a time: the poll below
+        // still runs between batches, so a busy neighbour can't starve this worker's
+        // own connections, listener and deadlines
+        int idle = 0;
+        if (self) {
+            coro = worker_idle();
+            if (coro) {
+                int stolen = 0;
+                do {
+                    coro_run(coro);
+                } while (++stolen < CORO_STEAL_BATCH && (coro = coro_steal()));
+            } else {
+                idle = 1;
             }
         }
 
+        // The wheels decide how long the loop may block, unless stolen work may be left
+        uint64_t now = timer_now_ms();
+        int timeout = timer_wheel_timeout(&timers, now);
+        int idle_timeout = timer_wheel_timeout(&idle_timers, now);
+        if (timeout < 0 || (idle_timeout >= 0 && idle_timeout < timeout)) timeout = idle_timeout;
+        if (self && !idle) timeout = 0;
+
+#ifndef FEATHER_NO_URING
+        if (use_uring) {
+            if (self) uring_watch_eventfd(self->wake_fd);
+            uint64_t poll_start = now_us();
+            int batch = uring_run(timeout);
+            if (idle) worker_busy();
+            timers_advance();
+
+            stats_poll(pass_start, poll_start, batch);
+            pass_start = now_us();
+            continue;
+        }
+#endif
 
-        if (!sleeping_coros_count) continue;
-        int n = epoll_wait(epoll_fd, events, 64, ready_coros.size > 0 ? 0 : -1);
+        uint64_t poll_start = now_us();
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        if (idle) worker_busy();
 
         for (int i = 0; i < n; ++i) {
-            Coro *coro = (Coro *) events[i].data.ptr;
-            if (events[i].events & coro->waiting_events) {
-                coro->state = CORO_READY;
-                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, coro->waiting_fd, NULL);
-                coro->waiting_fd = -1;
-                coro->waiting_events = 0;
-                sleeping_coros_count -= 1;
-                darr_push(&ready_coros, coro);
+            if (self && events[i].data.fd == self->wake_fd) {
+                eventfd_t value;
+                eventfd_read(self->wake_fd, &value);
+                continue;
             }
+
+            fd_wake(events[i].data.fd, events[i].events);
         }
+
+        timers_advance();
+
+        stats_poll(pass_start, poll_start, n);
+        pass_start = now_us();
     }
 
+    stats_register(0);
     close(epoll_fd);
 
+#ifndef FEATHER_NO_URING
+    if (use_uring) uring_deinit();
+#endif
+
     darr_foreach(Coro *, &ready_coros, coro) {
         coro_destroy(*coro);
         free(*coro);
@@ -1,9 +1,48 @@
 #ifndef __CORO_H__
 #define __CORO_H__
 
-#include <ucontext.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "timer.h"
 
 #define CORO_STACK_SIZE (1024 * 64)
+// handle_client keeps its 8 KiB read buffer, arena and scan state on the stack, about
+// 16 KiB before the handler's own frames, so smaller stacks would overflow on the first request
+#define CORO_MIN_STACK_SIZE (1024 * 32)
+
+// Finished coroutines past this many in a thread's pool give their stack pages back
+#define CORO_POOL_HIGH_WATER 256
+
+#define CORO_NO_DEADLINE UINT64_MAX
+
+// Runnable coroutines a worker exposes to thieves; the rest stay in its local queue
+#define CORO_DEQUE_SIZE 1024
+// Coroutines an idle worker steals and runs before it polls its own fds and timers again
+#define CORO_STEAL_BATCH 16
+
+// The hand-written switch in coro_switch.S covers x86-64 and aarch64; define
+// CORO_UCONTEXT to build with makecontext/swapcontext instead.
+#if !defined(CORO_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define CORO_UCONTEXT
+#endif
+
+#ifdef CORO_UCONTEXT
+#include <ucontext.h>
+
+typedef ucontext_t CoroContext;
+#else
+typedef struct {
+    void *sp;
+} CoroContext;
+#endif
+
+typedef enum {
+    CORO_BACKEND_AUTO,
+    CORO_BACKEND_EPOLL,
+    CORO_BACKEND_URING,
+} CoroBackend;
 
 typedef enum {
     CORO_READY,
@@ -21,18 +60,95 @@ typedef struct {
 typedef struct Coro Coro;
 
 struct Coro {
-    ucontext_t ctx;
+    CoroContext ctx;
     CoroEntry entry;
     void *stack;
+    size_t stack_size;
     CoroState state;
-    int waiting_fd;
-    int waiting_events;
+    Timer *wait_timer;
+    int migratable;
+
+    // Nonzero while it serves a sampled request, which its parks are then traced under
+    uint64_t trace_id;
+    uint64_t parked_ns;
+
+    // The deadline its fd was hibernated with, when coro_hibernate started it
+    uint64_t idle_deadline;
 };
 
+// What a worker's scheduler is up to. Each worker updates its own once per loop
+// pass; coro_stats copies them out for any thread.
+typedef struct {
+    uint64_t ready;         // runnable coroutines once the last poll's wakeups were handed out
+    uint64_t sleeping;      // parked on an fd, a timer or coro_park
+    uint64_t hibernated;    // fds parked through coro_hibernate
+    uint64_t polls;         // epoll_wait or io_uring waits
+    uint64_t events;        // fds or completions those returned
+    uint64_t last_batch;
+    uint64_t lag_us;        // time the last pass spent running coroutines before polling again
+    uint64_t busy_us;       // sum of those
+} CoroStats;
+
+// Fills up to `cap` entries, one per running worker, and returns how many there are
+size_t coro_stats(CoroStats *out, size_t cap);
+
 Coro *coro_spawn(void (*func)(void *), void *arg);
 void coro_start(void);
 void coro_yield(void);
 void coro_sleep_fd(int fd, int events);
+// Returns 1 once the fd is ready, 0 if `ms` passed first, and -1 with errno set if the
+// wait itself failed, e.g. EBADF. A negative `ms` waits forever.
+int coro_sleep_fd_timeout(int fd, int events, int ms);
 void coro_sleep_ms(int ms);
+void coro_set_stack_size(size_t size);
+
+// Picked per worker in coro_start. AUTO and URING fall back to epoll when io_uring
+// can't be set up; building with FEATHER_NO_URING leaves only epoll.
+void coro_set_backend(CoroBackend backend);
+
+// Lets idle workers steal runnable coroutines from busy ones. Call once, before the
+// `workers` threads enter coro_start. Only coroutines that opted in through
+// coro_set_migratable move, and only once nothing on their old worker refers to them.
+void coro_set_work_stealing(int workers);
+// For the running coroutine; returns the previous setting
+int coro_set_migratable(int migratable);
+// Records the running coroutine's parks as TRACE_PARK spans of request `id`; 0 stops
+void coro_set_trace(uint64_t id);
+
+// Parks the running coroutine until someone hands it to coro_wake
+Coro *coro_current(void);
+void coro_park(void);
+void coro_wake(Coro *coro);
+
+// Timers on the worker's wheel that wake the running coroutine. They are checked
+// once per scheduler pass, so arming or cancelling one never costs a syscall.
+void coro_timer_add(Timer *timer, uint64_t deadline);
+void coro_timer_cancel(Timer *timer);
+uint64_t coro_deadline(int timeout_ms);
+
+// Blocking-style socket I/O for the running coroutine, on whichever backend the
+// worker uses. Same return convention as the syscalls they replace; running out
+// of time fails with ETIMEDOUT. A negative timeout waits forever.
+int coro_accept(int sfd);
+ssize_t coro_recv(int fd, void *buf, size_t len, int timeout_ms);
+ssize_t coro_send(int fd, const void *buf, size_t len, int flags, int timeout_ms);
+// Gathering send; like coro_send it may write only part of the data
+ssize_t coro_sendv(int fd, const struct iovec *iov, int iovcnt, int flags, int timeout_ms);
+// Sends `count` bytes of `in_fd` from `*offset` with sendfile, advancing the offset.
+// Returns how many went out, which is less than `count` only if the file ended first.
+ssize_t coro_sendfile(int out_fd, int in_fd, off_t *offset, size_t count, int timeout_ms);
+
+// Parks `fd` with no coroutine attached, for connections that sit idle between
+// requests: the worker's event loop watches it from a small record, and once it's
+// readable `func(arg)` starts on a pooled coroutine. If `deadline` (see coro_deadline)
+// passes first the fd is closed instead. The caller must be done with the fd and not
+// touch it again.
+void coro_hibernate(int fd, uint64_t deadline, void (*func)(void *), void *arg);
+// In a coroutine coro_hibernate started, the deadline it was given, so a wakeup that
+// brings no request can hibernate again without extending it. CORO_NO_DEADLINE otherwise.
+uint64_t coro_idle_deadline(void);
+
+// fds that were waited on must be closed through here so their epoll slot is reset
+int coro_close(int fd);
 
 #endif
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+
+#include "files.h"
+#include "coro.h"
+#include "dyn_arr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+// A watched directory; it goes away with the last cached entry in it
+struct FileDir {
+    int wd;
+    char *path;
+    size_t path_len;
+    size_t entries;
+};
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+thread_local static int initialized = 0;
+// -1 when inotify isn't available: nothing is cached then, every request opens the file
+thread_local static int watch_fd = -1;
+thread_local static FileEntry *buckets[FILE_CACHE_BUCKETS];
+thread_local static FileEntry *lru_head = NULL;
+thread_local static FileEntry *lru_tail = NULL;
+thread_local static size_t entry_count = 0;
+thread_local static DynArr(FileDir *) dirs = {0};
+
+static uint64_t path_hash(const char *path, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) path[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const char *content_type(const char *path, size_t len) {
+    static const struct { const char *ext; const char *type; } types[] = {
+        { "html", "text/html; charset=utf-8" },
+        { "htm", "text/html; charset=utf-8" },
+        { "css", "text/css; charset=utf-8" },
+        { "js", "text/javascript; charset=utf-8" },
+        { "mjs", "text/javascript; charset=utf-8" },
+        { "json", "application/json" },
+        { "map", "application/json" },
+        { "txt", "text/plain; charset=utf-8" },
+        { "xml", "application/xml" },
+        { "svg", "image/svg+xml" },
+        { "png", "image/png" },
+        { "jpg", "image/jpeg" },
+        { "jpeg", "image/jpeg" },
+        { "gif", "image/gif" },
+        { "webp", "image/webp" },
+        { "avif", "image/avif" },
+        { "ico", "image/x-icon" },
+        { "woff", "font/woff" },
+        { "woff2", "font/woff2" },
+        { "wasm", "application/wasm" },
+        { "pdf", "application/pdf" },
+    };
+
+    const char *dot = NULL;
+    for (size_t i = len; i > 0 && path[i - 1] != '/'; --i) {
+        if (path[i - 1] == '.') {
+            dot = path + i;
+            break;
+        }
+    }
+
+    if (dot) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+            if (strcasecmp(dot, types[i].ext) == 0) return types[i].type;
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+static void lru_unlink(FileEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else lru_head = entry->next;
+
+    if (entry->next) entry->next->prev = entry->prev;
+    else lru_tail = entry->prev;
+
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(FileEntry *entry) {
+    entry->prev = NULL;
+    entry->next = lru_head;
+    if (lru_head) lru_head->prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+static void entry_free(FileEntry *entry) {
+    close(entry->fd);
+    free(entry->path);
+    free(entry);
+}
+
+static void dir_put(FileDir *dir) {
+    if (--dir->entries > 0) return;
+
+    // Already gone if the directory itself was removed
+    inotify_rm_watch(watch_fd, dir->wd);
+
+    for (size_t i = 0; i < dirs.size; ++i) {
+        if (dirs.items[i] == dir) {
+            dirs.items[i] = dirs.items[--dirs.size];
+            break;
+        }
+    }
+
+    free(dir->path);
+    free(dir);
+}
+
+// Takes the entry out of the cache; it's closed once the last holder releases it
+static void entry_drop(FileEntry *entry) {
+    FileEntry **link = &buckets[entry->hash % FILE_CACHE_BUCKETS];
+    while (*link != entry) link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
+
+    lru_unlink(entry);
+    entry_count -= 1;
+    entry->cached = 0;
+
+    FileDir *dir = entry->dir;
+    entry->dir = NULL;
+    dir_put(dir);
+
+    if (entry->refs == 0) entry_free(entry);
+}
+
+static FileEntry *entry_find(const char *path, size_t len, uint64_t hash) {
+    for (FileEntry *entry = buckets[hash % FILE_CACHE_BUCKETS]; entry; entry = entry->bucket_next) {
+        if (entry->hash == hash && entry->path_len == len && memcmp(entry->path, path, len) == 0) return entry;
+    }
+    return NULL;
+}
+
+// Dropping the last entry frees the dir, hence the count kept on the side
+static void dir_drop_all(FileDir *dir) {
+    size_t left = dir->entries;
+
+    for (FileEntry *entry = lru_head; entry && left > 0; ) {
+        FileEntry *next = entry->next;
+        if (entry->dir == dir) {
+            left -= 1;
+            entry_drop(entry);
+        }
+        entry = next;
+    }
+}
+
+static FileDir *dir_find(int wd) {
+    darr_foreach(FileDir *, &dirs, dir) {
+        if ((*dir)->wd == wd) return *dir;
+    }
+    return NULL;
+}
+
+static void handle_event(const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, so nothing cached can be trusted
+        while (lru_head) entry_drop(lru_head);
+        return;
+    }
+
+    FileDir *dir = dir_find(event->wd);
+    if (!dir) return;
+
+    if (event->len == 0) {
+        dir_drop_all(dir);
+        return;
+    }
+
+    char path[PATH_MAX];
+    size_t name_len = strlen(event->name);
+    if (dir->path_len + 1 + name_len >= sizeof(path)) {
+        dir_drop_all(dir);
+        return;
+    }
+
+    memcpy(path, dir->path, dir->path_len);
+    path[dir->path_len] = '/';
+    memcpy(path + dir->path_len + 1, event->name, name_len);
+
+    size_t len = dir->path_len + 1 + name_len;
+    FileEntry *entry = entry_find(path, len, path_hash(path, len));
+    if (entry) entry_drop(entry);
+}
+
+// One per worker, parked on the inotify fd until something changes
+static void watch_loop(void *arg) {
+    (void) arg;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t n = read(watch_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("inotify read");
+                return;
+            }
+
+            coro_sleep_fd(watch_fd, EPOLLIN);
+            continue;
+        }
+
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            handle_event(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static void cache_init(void) {
+    initialized = 1;
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+        perror("inotify_init1");
+        return;
+    }
+
+    coro_spawn(watch_loop, NULL);
+}
+
+// The watch has to exist before the file is opened, or a change in between would go unseen
+static FileDir *dir_get(const char *path, size_t len) {
+    const char *slash = memrchr(path, '/', len);
+    size_t dir_len = slash ? (size_t) (slash - path) : 0;
+
+    darr_foreach(FileDir *, &dirs, it) {
+        FileDir *dir = *it;
+        if (dir->path_len == dir_len && memcmp(dir->path, path, dir_len) == 0) return dir;
+    }
+
+    char dir_path[PATH_MAX];
+    if (dir_len + 2 > sizeof(dir_path)) return NULL;
+
+    if (dir_len == 0) {
+        dir_path[0] = slash ? '/' : '.';
+        dir_path[1] = '\0';
+    } else {
+        memcpy(dir_path, path, dir_len);
+        dir_path[dir_len] = '\0';
+    }
+
+    int wd = inotify_add_watch(watch_fd, dir_path, WATCH_MASK);
+    if (wd < 0) return NULL;
+
+    // Another path to a directory that's already watched: events would name files
+    // by that path, so nothing opened through this one could be invalidated
+    FileDir *dir = dir_find(wd);
+    if (dir) return NULL;
+
+    dir = malloc(sizeof(FileDir));
+    dir->wd = wd;
+    dir->path = strndup(path, dir_len);
+    dir->path_len = dir_len;
+    dir->entries = 0;
+    darr_push(&dirs, dir);
+
+    return dir;
+}
+
+static FileEntry *entry_open(const char *path, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+        return NULL;
+    }
+
+    FileEntry *entry = calloc(1, sizeof(FileEntry));
+    entry->path = strndup(path, len);
+    entry->path_len = len;
+    entry->fd = fd;
+    entry->size = st.st_size;
+    entry->content_type = content_type(path, len);
+
+    entry->etag_len = (size_t) snprintf(entry->etag, sizeof(entry->etag), "\"%llx-%llx\"",
+        (unsigned long long) st.st_mtim.tv_sec * 1000000000ULL + (unsigned long long) st.st_mtim.tv_nsec,
+        (unsigned long long) st.st_size);
+
+    struct tm tm;
+    gmtime_r(&st.st_mtim.tv_sec, &tm);
+    entry->last_modified_len = strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    return entry;
+}
+
+FileEntry *file_cache_get(const char *path, size_t len) {
+    if (!initialized) cache_init();
+
+    uint64_t hash = path_hash(path, len);
+
+    FileEntry *entry = entry_find(path, len, hash);
+    if (entry) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        entry->refs += 1;
+        return entry;
+    }
+
+    FileDir *dir = watch_fd >= 0 ? dir_get(path, len) : NULL;
+    if (dir) dir->entries += 1;
+
+    entry = entry_open(path, len);
+    if (!entry) {
+        int err = errno;
+        if (dir) dir_put(dir);
+        errno = err;
+        return NULL;
+    }
+
+    entry->refs = 1;
+    entry->hash = hash;
+
+    // Without a watch there'd be no way of noticing changes, so the file isn't kept
+    if (!dir) return entry;
+
+    if (entry_count >= FILE_CACHE_SIZE) {
+        for (FileEntry *victim = lru_tail; victim; victim = victim->prev) {
+            if (victim->refs == 0) {
+                entry_drop(victim);
+                break;
+            }
+        }
+    }
+
+    entry->dir = dir;
+    entry->cached = 1;
+    entry->bucket_next = buckets[hash % FILE_CACHE_BUCKETS];
+    buckets[hash % FILE_CACHE_BUCKETS] = entry;
+    lru_push_front(entry);
+    entry_count += 1;
+
+    return entry;
+}
+
+void file_cache_release(FileEntry *entry) {
+    if (--entry->refs == 0 && !entry->cached) entry_free(entry);
+}
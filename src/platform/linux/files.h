@@ -0,0 +1,45 @@
+#ifndef __FILES_H__
+#define __FILES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Open files kept per worker thread, least recently used go first
+#define FILE_CACHE_SIZE 64
+#define FILE_CACHE_BUCKETS 128
+
+typedef struct FileDir FileDir;
+typedef struct FileEntry FileEntry;
+
+// An open regular file with what its response headers need. Entries are dropped
+// as soon as inotify reports a change in their directory; one still in use stays
+// open until it's released.
+struct FileEntry {
+    char *path;
+    size_t path_len;
+    uint64_t hash;
+
+    int fd;
+    off_t size;
+    const char *content_type;
+    char etag[48];
+    size_t etag_len;
+    char last_modified[32];
+    size_t last_modified_len;
+
+    int refs;
+    int cached;
+    FileDir *dir;
+    FileEntry *bucket_next;
+    FileEntry *prev;
+    FileEntry *next;
+};
+
+// Returns the regular file at `path`, held until file_cache_release. Must be
+// released on the same thread, so the caller shouldn't be migratable meanwhile.
+// NULL with errno set if it can't be opened or isn't a regular file.
+FileEntry *file_cache_get(const char *path, size_t len);
+void file_cache_release(FileEntry *entry);
+
+#endif
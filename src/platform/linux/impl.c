@@ -1,9 +1,15 @@
+#define _GNU_SOURCE
+
 #include "feather.h"
 #include "coro.h"
+#include "files.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 #include "strview.h"
 #include <errno.h>
-#include <fcntl.h>
 #include <sched.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,121 +20,797 @@
 #include <threads.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <pthread.h>
 
+typedef enum {
+    BODY_DONE,
+    BODY_LENGTH,
+    BODY_CHUNK_SIZE,
+    BODY_CHUNK_DATA,
+    BODY_CHUNK_END,
+    BODY_TRAILER,
+    BODY_ERROR,
+} BodyState;
+
 struct FeatherCtx {
     int fd;
     int keep_alive;
+
+    // Set while more pipelined requests are already buffered. Their responses are
+    // collected in `out` and go out together with the last one of the batch.
+    int pipelined;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+
+    // Between feather_response_begin and feather_response_end
+    int streaming;
+    int stream_failed;
+
+    // Connection buffer: the current request's head, then whatever of its body and
+    // of later requests has arrived. Reading starts at `pos`; bytes below `floor`
+    // are still referenced and survive compaction.
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t pos;
+    size_t floor;
+
+    BodyState body_state;
+    size_t body_left;   // of the Content-Length or the current chunk
+    size_t body_read;
+    size_t max_body;
+
+    // Everything the current request allocates: extra headers, feather_alloc, feather_sprintf
+    FeatherArena arena;
+    // Its query and cookies, once a handler asks for them
+    FeatherRequestIndex index;
+
+    // Set while the handler of a cached route runs, so its response gets stored
+    const FeatherRoute *cache_route;
+    const FeatherRequest *cache_req;
+
+    // Of the current request's response, 0 until one was sent
+    int status;
+
+    // Nonzero when the current request is sampled for tracing
+    uint64_t trace_id;
 };
 
 static FeatherApp *_app;
+static int work_stealing = 0;
+static int access_log = 0;
+
+// How long an idle keep-alive connection may wait for its next request, how long
+// reading the rest of a request may take once it started, and how long writing a
+// response may go without progress
+#define KEEP_ALIVE_TIMEOUT_MS 5000
+#define READ_TIMEOUT_MS 10000
+#define WRITE_TIMEOUT_MS 10000
 
-thread_local static int counter = 0;
+// A keep-alive connection that stays quiet this long gives its coroutine, stack and
+// buffers back and waits out the rest of KEEP_ALIVE_TIMEOUT_MS hibernated
+#define HIBERNATE_AFTER_MS 100
 
-static int set_nonblocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) return -1;
-    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+// Deferred pipelined responses are flushed early once they add up to this much
+#define PIPELINE_FLUSH_SIZE (1024 * 64)
+
+static int time_left(uint64_t deadline) {
+    uint64_t now = timer_now_ms();
+    return deadline > now ? (int) (deadline - now) : 0;
 }
 
-typedef struct {
-    char *buf;
-    size_t len;
-    size_t parse_offset;
-} ConnBuf;
-
-static int http_request_complete_buf(ConnBuf *cbuf) {
-    size_t i = cbuf->parse_offset;
-    while (i + 3 < cbuf->len) {
-        if (
-            cbuf->buf[i] == '\r'
-            && cbuf->buf[i + 1] == '\n'
-            && cbuf->buf[i + 2] == '\r'
-            && cbuf->buf[i + 3] == '\n'
-        ) {
-            cbuf->parse_offset = i;
-            return 1;
+// Sends the whole iovec, advancing it past partial writes
+static int send_all(int fd, struct iovec *iov, int iovcnt, int flags) {
+    while (iovcnt > 0) {
+        ssize_t sent = coro_sendv(fd, iov, iovcnt, flags, WRITE_TIMEOUT_MS);
+        if (sent < 0) return -1;
+
+        while (iovcnt > 0 && (size_t) sent >= iov->iov_len) {
+            sent -= (ssize_t) iov->iov_len;
+            iov += 1;
+            iovcnt -= 1;
         }
 
-        i += 1;
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + sent;
+            iov->iov_len -= (size_t) sent;
+        }
     }
 
-    cbuf->parse_offset = i > 3 ? i - 3 : 0;
     return 0;
 }
 
+static void flush_pipelined(FeatherCtx *ctx) {
+    if (ctx->out_len == 0) return;
+
+    struct iovec iov = { .iov_base = ctx->out, .iov_len = ctx->out_len };
+    if (send_all(ctx->fd, &iov, 1, 0) < 0) {
+        perror("send");
+        ctx->keep_alive = 0;
+    }
+
+    ctx->out_len = 0;
+}
+
+// Appends to the deferred output of a pipelined batch
+static void out_append(FeatherCtx *ctx, const char *data, size_t len) {
+    if (ctx->out_len + len > ctx->out_cap) {
+        ctx->out_cap = ctx->out_cap ? ctx->out_cap * 2 : 4096;
+        if (ctx->out_cap < ctx->out_len + len) ctx->out_cap = ctx->out_len + len;
+        ctx->out = realloc(ctx->out, ctx->out_cap);
+    }
+
+    memcpy(ctx->out + ctx->out_len, data, len);
+    ctx->out_len += len;
+}
+
+// Serializes the head into `scratch`, or into a heap buffer when the headers don't fit
+static char *head_serialize(FeatherResponse *res, char *scratch, size_t cap, size_t *len) {
+    char *head = scratch;
+
+    while (!(*len = feather_dump_response_head(res, head, cap))) {
+        cap *= 2;
+        head = head == scratch ? malloc(cap) : realloc(head, cap);
+    }
+
+    feather_headers_deinit(&res->headers);
+    return head;
+}
+
+// Writes `iov` behind whatever pipelined responses are still held back. A failed
+// write ends the connection once the current response is done.
+static int ctx_send(FeatherCtx *ctx, const struct iovec *iov, int iovcnt, int flags) {
+    struct iovec all[4];
+    int count = 0;
+
+    if (ctx->out_len) all[count++] = (struct iovec) { .iov_base = ctx->out, .iov_len = ctx->out_len };
+    memcpy(all + count, iov, (size_t) iovcnt * sizeof(struct iovec));
+    count += iovcnt;
+
+    uint64_t traced = ctx->trace_id ? trace_now_ns() : 0;
+    int res = send_all(ctx->fd, all, count, flags);
+    ctx->out_len = 0;
+    if (traced) trace_span(ctx->trace_id, TRACE_SEND, traced, trace_now_ns(), NULL, 0, 0);
+
+    if (res < 0) {
+        perror("send");
+        ctx->keep_alive = 0;
+    }
+
+    return res;
+}
+
+static void ctx_response_done(FeatherCtx *ctx) {
+    if (!ctx->keep_alive) {
+        coro_close(ctx->fd);
+        ctx->fd = -1;
+    }
+}
+
+// Sends a response that's already serialized but for its Date header, held back
+// like any other while pipelining
+static void ctx_send_prebuilt(FeatherCtx *ctx, StrView head, StrView rest) {
+    StrView date = feather_date_header();
+
+    if (ctx->pipelined && ctx->keep_alive && ctx->out_len + head.len + date.len + rest.len <= PIPELINE_FLUSH_SIZE) {
+        out_append(ctx, head.ptr, head.len);
+        out_append(ctx, date.ptr, date.len);
+        out_append(ctx, rest.ptr, rest.len);
+        return;
+    }
+
+    struct iovec iov[3] = {
+        { .iov_base = (void *) head.ptr, .iov_len = head.len },
+        { .iov_base = (void *) date.ptr, .iov_len = date.len },
+        { .iov_base = (void *) rest.ptr, .iov_len = rest.len },
+    };
+
+    ctx_send(ctx, iov, 3, 0);
+    ctx_response_done(ctx);
+}
+
+// Receives more bytes into the connection buffer, first compacting away what was consumed
+static ssize_t conn_fill(FeatherCtx *ctx) {
+    if (ctx->pos > ctx->floor) {
+        memmove(ctx->buf + ctx->floor, ctx->buf + ctx->pos, ctx->len - ctx->pos);
+        ctx->len -= ctx->pos - ctx->floor;
+        ctx->pos = ctx->floor;
+    }
+
+    if (ctx->len == ctx->cap) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    ssize_t n = coro_recv(ctx->fd, ctx->buf + ctx->len, ctx->cap - ctx->len, READ_TIMEOUT_MS);
+    if (n > 0) ctx->len += (size_t) n;
+    return n;
+}
+
+static ssize_t body_fail(FeatherCtx *ctx, int err) {
+    ctx->body_state = BODY_ERROR;
+    ctx->keep_alive = 0;
+    errno = err;
+    return -1;
+}
+
+// Parses a chunk size line, ignoring extensions
+static int chunk_size(StrView line, size_t *size) {
+    size_t value = 0, i = 0;
+
+    for (; i < line.len; ++i) {
+        char c = line.ptr[i];
+        int digit = c >= '0' && c <= '9' ? c - '0'
+            : c >= 'a' && c <= 'f' ? c - 'a' + 10
+            : c >= 'A' && c <= 'F' ? c - 'A' + 10
+            : -1;
+
+        if (digit < 0) break;
+        if (value > (SIZE_MAX >> 4)) return 0;
+        value = value << 4 | (size_t) digit;
+    }
+
+    if (i == 0 || (i < line.len && line.ptr[i] != ';' && line.ptr[i] != ' ' && line.ptr[i] != '\t')) return 0;
+
+    *size = value;
+    return 1;
+}
+
+// Drops the spaces and tabs a field value or list element may be padded with
+static StrView trim_ows(StrView sv) {
+    while (sv.len > 0 && (sv.ptr[0] == ' ' || sv.ptr[0] == '\t')) {
+        sv.ptr += 1;
+        sv.len -= 1;
+    }
+    while (sv.len > 0 && (sv.ptr[sv.len - 1] == ' ' || sv.ptr[sv.len - 1] == '\t')) sv.len -= 1;
+    return sv;
+}
+
+// Strict decimal, so a value that doesn't fit is an error rather than wrapping around
+static int parse_length(StrView sv, size_t *out) {
+    sv = trim_ows(sv);
+    if (sv.len == 0) return 0;
+
+    size_t value = 0;
+    for (size_t i = 0; i < sv.len; ++i) {
+        if (sv.ptr[i] < '0' || sv.ptr[i] > '9') return 0;
+
+        size_t digit = (size_t) (sv.ptr[i] - '0');
+        if (value > (SIZE_MAX - digit) / 10) return 0;
+        value = value * 10 + digit;
+    }
+
+    *out = value;
+    return 1;
+}
+
+// The request's Content-Length, 0 without one. The parsed headers only keep the last
+// of repeated fields, so the scanned lines are checked for copies that disagree.
+static int request_length(const char *buf, const FeatherScan *scan, size_t *out) {
+    int seen = 0;
+    *out = 0;
+
+    for (size_t i = 1; i < scan->line_count; ++i) {
+        const FeatherLine *line = &scan->lines[i];
+        if (line->colon == FEATHER_NO_COLON) continue;
+        if (feather_header_id(sv_from_buf(buf + line->start, line->colon)) != FEATHER_HEADER_CONTENT_LENGTH) continue;
+
+        size_t value;
+        if (!parse_length(sv_from_buf(buf + line->start + line->colon + 1, line->len - line->colon - 1), &value)) return 0;
+        if (seen && value != *out) return 0;
+
+        *out = value;
+        seen = 1;
+    }
+
+    return 1;
+}
+
+// Sets `chunked` if the request's Transfer-Encoding ends in chunked, taking every
+// Transfer-Encoding line as one list. Returns 0, or the status to reject it with: 400
+// when the body's length can't be told, 501 for codings we can't decode.
+static int request_chunked(const char *buf, const FeatherScan *scan, int *chunked) {
+    int seen = 0, codings = 0, last_chunked = 0;
+    *chunked = 0;
+
+    for (size_t i = 1; i < scan->line_count; ++i) {
+        const FeatherLine *line = &scan->lines[i];
+        if (line->colon == FEATHER_NO_COLON) continue;
+        if (feather_header_id(sv_from_buf(buf + line->start, line->colon)) != FEATHER_HEADER_TRANSFER_ENCODING) continue;
+
+        seen = 1;
+        StrView rest = sv_from_buf(buf + line->start + line->colon + 1, line->len - line->colon - 1);
+        while (rest.len > 0) {
+            const char *comma = memchr(rest.ptr, ',', rest.len);
+            size_t len = comma ? (size_t) (comma - rest.ptr) : rest.len;
+            StrView coding = trim_ows(sv_from_buf(rest.ptr, len));
+            rest = comma ? sv_from_buf(comma + 1, rest.len - len - 1) : sv_from_buf(NULL, 0);
+
+            // Empty list elements don't count
+            if (coding.len == 0) continue;
+
+            // Chunked can only come last, and only once
+            if (last_chunked) return 400;
+            last_chunked = sv_ieq(coding, "chunked");
+            codings += 1;
+        }
+    }
+
+    if (!seen) return 0;
+    if (!last_chunked) return 400;
+    if (codings > 1) return 501;
+
+    *chunked = 1;
+    return 0;
+}
+
+// Pulls up to `n` bytes of the body into `dst`, decoding chunked framing, and
+// returns 0 once it's complete. Buffered bytes are used first; after that data
+// is received straight into `dst` unless it points into the connection buffer.
+static ssize_t body_read(FeatherCtx *ctx, char *dst, size_t n) {
+    while (1) {
+        switch (ctx->body_state) {
+            case BODY_DONE:
+                return 0;
+
+            case BODY_ERROR:
+                errno = EPROTO;
+                return -1;
+
+            case BODY_LENGTH:
+            case BODY_CHUNK_DATA: {
+                if (ctx->body_left == 0) {
+                    ctx->body_state = ctx->body_state == BODY_LENGTH ? BODY_DONE : BODY_CHUNK_END;
+                    continue;
+                }
+
+                if (n == 0) return 0;
+
+                size_t want = n < ctx->body_left ? n : ctx->body_left;
+                size_t have = ctx->len - ctx->pos;
+                ssize_t got;
+
+                if (have > 0) {
+                    got = (ssize_t) (want < have ? want : have);
+                    memmove(dst, ctx->buf + ctx->pos, (size_t) got);
+                    ctx->pos += (size_t) got;
+                } else if (dst < ctx->buf || dst >= ctx->buf + ctx->cap) {
+                    got = coro_recv(ctx->fd, dst, want, READ_TIMEOUT_MS);
+                    if (got <= 0) return body_fail(ctx, got == 0 ? ECONNRESET : errno);
+                } else {
+                    ssize_t filled = conn_fill(ctx);
+                    if (filled <= 0) return body_fail(ctx, filled == 0 ? ECONNRESET : errno);
+                    continue;
+                }
+
+                ctx->body_left -= (size_t) got;
+                ctx->body_read += (size_t) got;
+                if (ctx->max_body && ctx->body_read > ctx->max_body) return body_fail(ctx, EMSGSIZE);
+
+                return got;
+            }
+
+            case BODY_CHUNK_SIZE:
+            case BODY_CHUNK_END:
+            case BODY_TRAILER: {
+                char *nl = memchr(ctx->buf + ctx->pos, '\n', ctx->len - ctx->pos);
+                if (!nl) {
+                    ssize_t filled = conn_fill(ctx);
+                    if (filled <= 0) return body_fail(ctx, filled == 0 ? ECONNRESET : errno);
+                    continue;
+                }
+
+                StrView line = sv_from_buf(ctx->buf + ctx->pos, nl - (ctx->buf + ctx->pos));
+                if (line.len > 0 && line.ptr[line.len - 1] == '\r') line.len -= 1;
+                ctx->pos = (size_t) (nl + 1 - ctx->buf);
+
+                if (ctx->body_state == BODY_CHUNK_SIZE) {
+                    if (!chunk_size(line, &ctx->body_left)) return body_fail(ctx, EPROTO);
+                    ctx->body_state = ctx->body_left ? BODY_CHUNK_DATA : BODY_TRAILER;
+                } else if (ctx->body_state == BODY_CHUNK_END) {
+                    if (line.len) return body_fail(ctx, EPROTO);
+                    ctx->body_state = BODY_CHUNK_SIZE;
+                } else if (line.len == 0) {
+                    ctx->body_state = BODY_DONE;
+                }
+                continue;
+            }
+        }
+    }
+}
+
+// Rejects a malformed request or one with a body we won't take; the connection can't
+// be reused since the rest of it would be read as the next request
+static void reject_request(FeatherCtx *ctx, int status) {
+    ctx->keep_alive = 0;
+
+    FeatherResponse res = {0};
+    res.status = status;
+    res.body = status == 413 ? SV_LIT("<h3>Content Too Large</h3>")
+        : status == 431 ? SV_LIT("<h3>Request Header Fields Too Large</h3>")
+        : status == 501 ? SV_LIT("<h3>Not Implemented</h3>")
+        : SV_LIT("<h3>Bad Request</h3>");
+    res.headers.content_type = SV_LIT("text/html");
+    feather_response_send(ctx, &res);
+}
+
+// Like feather_response_send, except that the kernel sends the body straight from `fd`
+static void response_send_file(FeatherCtx *ctx, FeatherResponse *res, int fd, off_t offset, size_t count) {
+    ctx->status = res->status;
+    if (!ctx->keep_alive) {
+        res->headers.connection = SV_LIT("close");
+    }
+
+    // Decimal digits written back to front, like the size lines of chunks
+    char content_length[20];
+    char *p = content_length + sizeof(content_length);
+    size_t left = count;
+    do {
+        *--p = (char) ('0' + left % 10);
+        left /= 10;
+    } while (left);
+    res->headers.content_length = sv_from_buf(p, (size_t) (content_length + sizeof(content_length) - p));
+
+    char scratch[1024];
+    size_t head_len;
+    char *head = head_serialize(res, scratch, sizeof(scratch), &head_len);
+
+    // MSG_MORE holds the head back so it leaves in the same segment as the file's first bytes
+    int body = fd >= 0 && count > 0;
+    struct iovec iov = { .iov_base = head, .iov_len = head_len };
+    int sent = ctx_send(ctx, &iov, 1, body ? MSG_MORE : 0);
+    if (head != scratch) free(head);
+
+    if (sent == 0 && body) {
+        ssize_t n = coro_sendfile(ctx->fd, fd, &offset, count, WRITE_TIMEOUT_MS);
+        if (n < 0) perror("sendfile");
+
+        // Also when the file shrank meanwhile: the client is owed more bytes than there are
+        if (n != (ssize_t) count) ctx->keep_alive = 0;
+    }
+
+    ctx_response_done(ctx);
+}
+
+static int parse_offset(StrView sv, off_t *out) {
+    if (sv.len == 0 || sv.len > 18) return 0;
+
+    off_t value = 0;
+    for (size_t i = 0; i < sv.len; ++i) {
+        if (sv.ptr[i] < '0' || sv.ptr[i] > '9') return 0;
+        value = value * 10 + (sv.ptr[i] - '0');
+    }
+
+    *out = value;
+    return 1;
+}
+
+// Resolves a "bytes=" Range header against the file size. Returns 1 with the inclusive
+// range filled in, -1 if it can't be satisfied, and 0 to ignore it and send everything,
+// which is also what happens to multiple ranges.
+static int parse_range(StrView range, off_t size, off_t *start, off_t *end) {
+    if (!sv_startswith(range, "bytes=")) return 0;
+
+    StrView spec = sv_from_buf(range.ptr + 6, range.len - 6);
+    if (memchr(spec.ptr, ',', spec.len)) return 0;
+
+    const char *dash = memchr(spec.ptr, '-', spec.len);
+    if (!dash) return 0;
+
+    StrView first = sv_from_buf(spec.ptr, dash - spec.ptr);
+    StrView last = sv_from_buf(dash + 1, spec.len - first.len - 1);
+    off_t a, b;
+
+    // "-n" is the last n bytes
+    if (first.len == 0) {
+        if (!parse_offset(last, &b)) return 0;
+        if (b == 0 || size == 0) return -1;
+
+        *start = b < size ? size - b : 0;
+        *end = size - 1;
+        return 1;
+    }
+
+    if (!parse_offset(first, &a)) return 0;
+
+    b = size - 1;
+    if (last.len > 0) {
+        if (!parse_offset(last, &b) || b < a) return 0;
+        if (b >= size) b = size - 1;
+    }
+
+    if (a >= size) return -1;
+
+    *start = a;
+    *end = b;
+    return 1;
+}
+
+// If-None-Match holds a list of tags, any of which may be weak
+static int etag_matches(StrView list, StrView etag) {
+    while (list.len > 0) {
+        // Without a comma the whole list is the last tag
+        StrView tag;
+        sv_split_once_strview(list, ",", &tag, &list);
+
+        while (tag.len > 0 && tag.ptr[0] == ' ') tag = sv_from_buf(tag.ptr + 1, tag.len - 1);
+        while (tag.len > 0 && tag.ptr[tag.len - 1] == ' ') tag.len -= 1;
+        if (sv_startswith(tag, "W/")) tag = sv_from_buf(tag.ptr + 2, tag.len - 2);
+
+        if (sv_eq(tag, "*") || sv_eq(tag, etag)) return 1;
+    }
+
+    return 0;
+}
+
+static void serve_static(FeatherCtx *ctx, const FeatherRequest *req, const FeatherStaticMount *mount, StrView rel) {
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+
+    size_t cap = mount->root.len + rel.len + 16;
+    char *path = feather_alloc(ctx, cap);
+    size_t path_len = feather_static_path(mount, rel, path, cap);
+
+    FileEntry *file = path_len ? file_cache_get(path, path_len) : NULL;
+    if (!file) {
+        res.status = 404;
+        res.body = SV_LIT("<h3>Not Found</h3>");
+        res.headers.content_type = SV_LIT("text/html");
+        feather_response_send(ctx, &res);
+        return;
+    }
+
+    // The entry belongs to this worker's cache until it's released
+    int migratable = coro_set_migratable(0);
+
+    StrView etag = sv_from_buf(file->etag, file->etag_len);
+    StrView last_modified = sv_from_buf(file->last_modified, file->last_modified_len);
+    feather_set_header(&res.headers, SV_LIT("ETag"), etag);
+    feather_set_header(&res.headers, SV_LIT("Last-Modified"), last_modified);
+
+    // If-Modified-Since only counts without If-None-Match, and like in nginx it has
+    // to match exactly, which is what clients echo back anyway
+    StrView if_none_match = feather_get_header_id(&req->headers, FEATHER_HEADER_IF_NONE_MATCH);
+    int not_modified = if_none_match.len > 0
+        ? etag_matches(if_none_match, etag)
+        : sv_eq(feather_get_header_id(&req->headers, FEATHER_HEADER_IF_MODIFIED_SINCE), last_modified);
+
+    if (not_modified) {
+        res.status = 304;
+        feather_response_send(ctx, &res);
+        goto done;
+    }
+
+    off_t start = 0, end = file->size - 1;
+    res.status = 200;
+
+    // A stale If-Range validator means the client's copy changed, so it gets all of it
+    StrView range = feather_get_header_id(&req->headers, FEATHER_HEADER_RANGE);
+    StrView if_range = feather_get_header_id(&req->headers, FEATHER_HEADER_IF_RANGE);
+    if (range.len > 0 && (if_range.len == 0 || sv_eq(if_range, etag) || sv_eq(if_range, last_modified))) {
+        int ranged = parse_range(range, file->size, &start, &end);
+
+        if (ranged < 0) {
+            res.status = 416;
+            res.headers.content_length = SV_LIT("0");
+            feather_set_header(&res.headers, SV_LIT("Content-Range"), feather_sprintf(ctx, "bytes */%lld", (long long) file->size));
+            feather_response_send(ctx, &res);
+            goto done;
+        }
+
+        if (ranged > 0) {
+            res.status = 206;
+            feather_set_header(&res.headers, SV_LIT("Content-Range"),
+                feather_sprintf(ctx, "bytes %lld-%lld/%lld", (long long) start, (long long) end, (long long) file->size));
+        }
+    }
+
+    res.headers.content_type = sv_from_cstr(file->content_type);
+    feather_set_header(&res.headers, SV_LIT("Accept-Ranges"), SV_LIT("bytes"));
+    response_send_file(ctx, &res, req->method == FEATHER_HEAD ? -1 : file->fd, start, (size_t) (end - start + 1));
+
+done:
+    file_cache_release(file);
+    coro_set_migratable(migratable);
+}
+
 static void handle_client(void *arg) {
-    counter += 1;
     int cfd = (intptr_t) arg;
-    set_nonblocking(cfd);
 
-    FeatherCtx ctx = { .fd = cfd, .keep_alive = 1 };
+    // Between requests nothing ties the connection to a worker
+    coro_set_migratable(work_stealing);
+
+    // Lives across requests: whatever follows the current request is the start of the next
+    char buf[8192];
+    FeatherCtx ctx = { .fd = cfd, .keep_alive = 1, .buf = buf, .cap = sizeof(buf) };
+    FeatherScan scan;
+    feather_scan_reset(&scan);
+
+    // Enough for the headers and scratch of a typical request, so those never reach malloc
+    char arena_buf[1024 * 4] __attribute__((aligned(FEATHER_ARENA_ALIGN)));
+    feather_arena_init(&ctx.arena, arena_buf, sizeof(arena_buf));
+
+    // Set while the connection waits for its next request; a wakeup from hibernation
+    // that brings none keeps the deadline it went to sleep with
+    uint64_t idle_deadline = coro_idle_deadline();
+
     while (ctx.keep_alive) {
-        char buf[8192];
-        ConnBuf cbuf = {0};
-        cbuf.buf = buf;
-        ssize_t total = 0;
+        uint64_t read_deadline = timer_now_ms() + READ_TIMEOUT_MS;
+        ctx.trace_id = trace_sample();
+        uint64_t trace_at = ctx.trace_id ? trace_now_ns() : 0;
+
+        while (!feather_scan_request(&scan, buf, ctx.len)) {
+            // Nothing more to answer until the client sends again
+            flush_pipelined(&ctx);
+
+            int idle = ctx.len == 0;
+            if (idle && idle_deadline == CORO_NO_DEADLINE) idle_deadline = timer_now_ms() + KEEP_ALIVE_TIMEOUT_MS;
 
-        while (!http_request_complete_buf(&cbuf)) {
-            ssize_t n = recv(cfd, buf + total, sizeof(buf) - total - 1, 0);
+            int timeout = idle ? time_left(idle_deadline) : time_left(read_deadline);
+            if (idle && timeout > HIBERNATE_AFTER_MS) timeout = HIBERNATE_AFTER_MS;
+            ssize_t n = ctx.keep_alive && ctx.len < ctx.cap ? coro_recv(cfd, buf + ctx.len, ctx.cap - ctx.len, timeout) : -1;
 
             if (n > 0) {
-                total += n;
-                cbuf.len = total;
+                if (ctx.len == 0) {
+                    idle_deadline = CORO_NO_DEADLINE;
+                    read_deadline = timer_now_ms() + READ_TIMEOUT_MS;
+                    if (ctx.trace_id) trace_at = trace_now_ns();
+                }
+                ctx.len += n;
                 continue;
             }
 
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                coro_sleep_fd(cfd, EPOLLIN);
-                continue;
+            free(ctx.out);
+            feather_arena_deinit(&ctx.arena);
+
+            // Nothing is buffered, so the connection can start over from scratch later
+            if (idle && ctx.keep_alive && n < 0 && errno == ETIMEDOUT && time_left(idle_deadline) > 0) {
+                coro_hibernate(cfd, idle_deadline, handle_client, arg);
+                return;
             }
 
-            close(cfd);
+            coro_close(cfd);
             return;
         }
 
-        char *header_end = strstr(buf, "\r\n\r\n");
-        if (!header_end) {
-            close(cfd);
-            return;
-        }
-        size_t headers_end = (header_end - buf) + 4;
+        size_t headers_end = scan.header_end;
 
         FeatherRequest req = {0};
-        feather_parse_request(&req, sv_from_buf(buf, headers_end));
+        req.headers.arena = &ctx.arena;
+        req.arena = &ctx.arena;
+        req.index = &ctx.index;
+        ctx.index.query.parsed = ctx.index.cookies.parsed = 0;
+        ctx.index.query.count = ctx.index.cookies.count = 0;
+        uint64_t trace_head = 0;
+        if (ctx.trace_id) {
+            trace_head = trace_now_ns();
+            trace_span(ctx.trace_id, TRACE_RECV, trace_at, trace_head, NULL, 0, 0);
+            coro_set_trace(ctx.trace_id);
+        }
 
-        size_t content_length = 0;
+        // A head with lines the scanner dropped may have lost the ones that frame its body
+        int parsed = feather_parse_scanned(&req, buf, &scan) && !scan.truncated;
+        uint64_t started = metrics_now_us();
+        ctx.status = 0;
 
-        if (req.headers.content_length.len > 0) {
-            content_length = sv_atoi(req.headers.content_length);
+        const FeatherRoute *route = NULL;
+        const FeatherStaticMount *mount = NULL;
+        StrView static_rel;
+
+        // Rejected requests skip to `done` so they're still counted and traced
+        if (!parsed) {
+            reject_request(&ctx, scan.truncated ? 431 : 400);
+            goto done;
         }
 
-        while ((size_t) total < headers_end + content_length) {
-            ssize_t n = recv(cfd, buf + total, sizeof(buf) - total - 1, 0);
-            if (n > 0) {
-                total += n;
-                continue;
+        if (ctx.trace_id) {
+            trace_at = trace_now_ns();
+            trace_span(ctx.trace_id, TRACE_PARSE, trace_head, trace_at, NULL, 0, 0);
+        }
+
+        if (sv_ieq(req.headers.connection, "close")) {
+            ctx.keep_alive = 0;
+        }
+
+        route = feather_find_route(_app, &req);
+        int stream_body = route && route->options.stream_body;
+        mount = route ? NULL : feather_find_static(_app, &req, &static_rel);
+
+        if (ctx.trace_id) {
+            uint64_t now = trace_now_ns();
+            trace_span(ctx.trace_id, TRACE_ROUTE, trace_at, now, NULL, 0, 0);
+            trace_at = now;
+        }
+
+        // Framing we can't be sure of could hide a second request in the body
+        size_t content_length;
+        int chunked, framing = request_chunked(buf, &scan, &chunked);
+        if (!framing && !request_length(buf, &scan, &content_length)) framing = 400;
+        if (framing) {
+            reject_request(&ctx, framing);
+            goto done;
+        }
+
+        ctx.pos = ctx.floor = headers_end;
+        ctx.body_left = content_length;
+        ctx.body_read = 0;
+        ctx.max_body = route ? route->options.max_body : 0;
+        ctx.body_state = content_length ? BODY_LENGTH : BODY_DONE;
+
+        // Chunked framing takes precedence over a Content-Length, but a request with
+        // both may have been framed differently by whatever sent it (RFC 9112 section 6.1)
+        if (chunked) {
+            ctx.body_state = BODY_CHUNK_SIZE;
+            if (req.headers.content_length.len > 0) ctx.keep_alive = 0;
+        }
+
+        int too_large = ctx.body_state == BODY_LENGTH && (
+            (ctx.max_body && content_length > ctx.max_body)
+            || (!stream_body && content_length > ctx.cap - headers_end)
+        );
+
+        if (too_large) {
+            reject_request(&ctx, 413);
+            goto done;
+        }
+
+        if (ctx.body_state != BODY_DONE && sv_ieq(feather_get_header_id(&req.headers, FEATHER_HEADER_EXPECT), "100-continue")) {
+            struct iovec iov = { .iov_base = "HTTP/1.1 100 Continue\r\n\r\n", .iov_len = 25 };
+            ctx_send(&ctx, &iov, 1, 0);
+        }
+
+        // Unless the route pulls it with feather_request_read, the whole body is read
+        // into the buffer behind the head, decoded in place if it's chunked
+        if (!stream_body) {
+            ssize_t n = 0;
+            while (ctx.body_state != BODY_DONE) {
+                n = ctx.floor < ctx.cap ? body_read(&ctx, buf + ctx.floor, ctx.cap - ctx.floor) : body_fail(&ctx, EMSGSIZE);
+                if (n < 0) break;
+                ctx.floor += (size_t) n;
             }
 
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                coro_sleep_fd(cfd, EPOLLIN);
-                continue;
+            if (n < 0) {
+                if (errno == EMSGSIZE) reject_request(&ctx, 413);
+                goto done;
             }
 
-            close(cfd);
-            return;
+            req.body = sv_from_buf(buf + headers_end, ctx.floor - headers_end);
         }
 
-        req.body = sv_from_buf(buf + headers_end, content_length);
+        // Anything already buffered past this request means the client pipelined the next one
+        ctx.pipelined = !stream_body && ctx.len > ctx.pos;
 
-        if (sv_ieq(req.headers.connection, "close")) {
-            ctx.keep_alive = 0;
+        if (ctx.trace_id) {
+            uint64_t now = trace_now_ns();
+            if (!stream_body && req.body.len > 0) trace_span(ctx.trace_id, TRACE_BODY, trace_at, now, NULL, 0, 0);
+            trace_at = now;
         }
 
-        FeatherHandler h = feather_find_handler(_app, &req);
+        StrView cached_head, cached_rest;
+        FeatherCacheEntry *hit = route && route->options.cache_ttl_ms > 0 ? feather_cache_lookup(route, &req, &cached_head, &cached_rest) : NULL;
 
-        if (h) {
-            h(&req, &ctx);
+        if (hit) {
+            // Only 200 responses are cached
+            ctx.status = 200;
+            ctx_send_prebuilt(&ctx, cached_head, cached_rest);
+            feather_cache_release(hit);
+        } else if (route) {
+            if (route->options.cache_ttl_ms > 0) {
+                ctx.cache_route = route;
+                ctx.cache_req = &req;
+            }
+
+            coro_set_migratable(work_stealing && route->options.migratable);
+            route->handler(&req, &ctx);
+            coro_set_migratable(work_stealing);
+            ctx.cache_route = NULL;
+
+            // A handler that returned without ending its chunked body
+            if (ctx.streaming) feather_response_end(&ctx);
+        } else if (mount) {
+            serve_static(&ctx, &req, mount, static_rel);
         } else {
             FeatherResponse res = {0};
             res.status = 404;
@@ -137,8 +819,42 @@ static void handle_client(void *arg) {
             feather_response_send(&ctx, &res);
         }
 
-        darr_deinit(&req.headers.other);
+done:
+        feather_headers_deinit(&req.headers);
+
+        if (ctx.trace_id) {
+            uint64_t now = trace_now_ns();
+            StrView label = route ? route->pattern : !parsed ? SV_LIT("bad request") : mount ? SV_LIT("static") : SV_LIT("not found");
+            trace_span(ctx.trace_id, TRACE_HANDLER, trace_at, now, NULL, 0, 0);
+            trace_span(ctx.trace_id, TRACE_REQUEST, trace_head, now, label.ptr, label.len, ctx.status);
+            coro_set_trace(0);
+        }
+
+        size_t series = route ? (size_t) (route - _app->routes)
+            : _app->route_count + (!parsed ? METRICS_SERIES_BAD_REQUEST : mount ? METRICS_SERIES_STATIC : METRICS_SERIES_NOT_FOUND);
+        uint64_t elapsed_us = metrics_now_us() - started;
+        metrics_request(series, ctx.status, elapsed_us);
+        if (access_log) log_access(req.method, req.path, req.query, ctx.status, elapsed_us);
+
+        // Where the next request starts is unknown if the handler left part of the body unread
+        if (ctx.body_state != BODY_DONE) ctx.keep_alive = 0;
+
+        // The handler is done with the request, so its bytes and allocations can go
+        feather_arena_reset(&ctx.arena);
+        memmove(buf, buf + ctx.pos, ctx.len - ctx.pos);
+        ctx.len -= ctx.pos;
+        ctx.pos = ctx.floor = 0;
+        feather_scan_reset(&scan);
+    }
+
+    // A request that got no answer, e.g. from a handler that never answered a
+    // `Connection: close` request: the responses held back before it are still owed
+    if (ctx.fd >= 0) {
+        flush_pipelined(&ctx);
+        coro_close(ctx.fd);
     }
+    free(ctx.out);
+    feather_arena_deinit(&ctx.arena);
 }
 
 static int create_listen_socket(int port) {
@@ -178,96 +894,332 @@ static int create_listen_socket(int port) {
 }
 
 static void accept_loop(void *arg) {
-    int sfd = create_listen_socket((intptr_t) arg);
+    int sfd = (intptr_t) arg;
 
     while (1) {
-        int cfd = accept(sfd, NULL, NULL);
+        int cfd = coro_accept(sfd);
         if (cfd < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                coro_sleep_fd(sfd, EPOLLIN);
-                continue;
-            } else {
-                perror("accept");
-                break;
-            }
+            perror("accept");
+            break;
         }
 
+        metrics_connection();
         coro_spawn(handle_client, (void *)(intptr_t) cfd);
     }
 
-    close(sfd);
+    coro_close(sfd);
 }
 
-#define NUM_WORKERS 6
+// Keeps this worker's Date header current, waking right after each second starts
+static void date_loop(void *arg) {
+    (void) arg;
+
+    while (1) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        feather_update_date(now.tv_sec);
+
+        coro_sleep_ms(1000 - (int) (now.tv_nsec / 1000000));
+    }
+}
 
 static void *worker(void *arg) {
     coro_spawn(accept_loop, arg);
+    coro_spawn(date_loop, NULL);
 
     coro_start();
 
     return NULL;
 }
 
+// The i-th CPU this process may run on, wrapping around when there are fewer
+static int nth_cpu(const cpu_set_t *set, int i) {
+    int count = CPU_COUNT(set);
+
+    for (int cpu = 0, seen = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, set) && seen++ == i % count) return cpu;
+    }
+
+    return 0;
+}
+
+// Sockets join the reuseport group in the order they were bound, and the program
+// returns the index of the one to use: that of the worker pinned to the CPU the
+// packet came in on. Other CPUs fall back to spreading by CPU number.
+static void attach_cpu_steering(int sfd, const int *cpus, int workers) {
+    struct sock_filter code[2 + 2 * workers + 2];
+    size_t n = 0;
+
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU));
+
+    for (int i = 0; i < workers; ++i) {
+        code[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) cpus[i], 0, 1);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, (uint32_t) i);
+    }
+
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) workers);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+    struct sock_fprog prog = { .len = (unsigned short) n, .filter = code };
+    if (setsockopt(sfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        // The kernel keeps hashing connections to workers then
+        perror("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+    }
+}
+
 int feather_run(FeatherApp *app, int port) {
-    pthread_t workers[NUM_WORKERS];
+    return feather_run_config(app, &(FeatherRunConfig) { .port = port });
+}
+
+int feather_run_config(FeatherApp *app, const FeatherRunConfig *config) {
     _app = app;
+    feather_freeze_app(app);
+    metrics_init(app);
+
+    if (config->access_log) {
+        if (feather_log_open(strcmp(config->access_log, "-") == 0 ? NULL : config->access_log) < 0) {
+            perror(config->access_log);
+            exit(1);
+        }
+        access_log = 1;
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0) {
+        CPU_SET(0, &allowed);
+    }
+
+    int count = config->workers > 0 ? config->workers : config->cpus ? config->cpu_count : CPU_COUNT(&allowed);
+    if (count < 1) count = 1;
+    int pin = config->pin_workers || config->steer_by_cpu;
 
-    for (int i = 0; i < NUM_WORKERS; ++i) {
-        pthread_create(&workers[i], NULL, worker, (void *)(intptr_t) port);
+    if (config->cpus && config->cpu_count < count) {
+        fprintf(stderr, "%d workers need as many entries in cpus, got %d\n", count, config->cpu_count);
+        exit(1);
+    }
+
+    int *cpus = malloc((size_t) count * sizeof(int));
+    for (int i = 0; i < count; ++i) {
+        cpus[i] = config->cpus ? config->cpus[i] : nth_cpu(&allowed, i);
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            fprintf(stderr, "cpu %d is out of range\n", cpus[i]);
+            exit(1);
+        }
+    }
+
+    if (work_stealing) coro_set_work_stealing(count);
+
+    // Bound here in worker order, which is what the steering program relies on
+    int *sfds = malloc((size_t) count * sizeof(int));
+    for (int i = 0; i < count; ++i) {
+        sfds[i] = create_listen_socket(config->port);
     }
 
-    for (int i = 0; i < NUM_WORKERS; ++i) {
+    if (config->steer_by_cpu) attach_cpu_steering(sfds[0], cpus, count);
+
+    pthread_t *workers = malloc((size_t) count * sizeof(pthread_t));
+    for (int i = 0; i < count; ++i) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        if (pin) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+
+        int err = pthread_create(&workers[i], &attr, worker, (void *)(intptr_t) sfds[i]);
+        pthread_attr_destroy(&attr);
+
+        if (err) {
+            errno = err;
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
         pthread_join(workers[i], NULL);
     }
 
+    free(workers);
+    free(sfds);
+    free(cpus);
+
     return 0;
 }
 
-
 void feather_response_send(FeatherCtx *ctx, FeatherResponse *res) {
-    if (!ctx || ctx->fd < 0 || !res) return;
+    if (!ctx || ctx->fd < 0 || !res || ctx->streaming) return;
+    ctx->status = res->status;
+
+    // Goes out as the cache has it, so the next hit sends the very same bytes
+    if (ctx->cache_route) {
+        StrView head, rest;
+        FeatherCacheEntry *entry = feather_cache_store(ctx->cache_route, ctx->cache_req, res, &head, &rest);
+        ctx->cache_route = NULL;
+
+        if (entry) {
+            feather_headers_deinit(&res->headers);
+            ctx_send_prebuilt(ctx, head, rest);
+            feather_cache_release(entry);
+            return;
+        }
+    }
 
-    char buf[1024];
     if (!ctx->keep_alive) {
         res->headers.connection = SV_LIT("close");
     }
 
 
-    char content_length[21];
+    // Emitted from the body's length instead
     if (res->body.len > 0) {
-        int n = snprintf(content_length, sizeof(content_length), "%zu", res->body.len);
-        res->headers.content_length = sv_from_buf(content_length, n);
+        res->headers.content_length = sv_from_buf(NULL, 0);
     }
 
-    size_t len = feather_dump_response(res, buf, sizeof(buf));
-    size_t sent_total = 0;
+    // Only the head is serialized; it nearly always fits on the stack
+    char scratch[1024];
+    size_t head_len;
+    char *head = head_serialize(res, scratch, sizeof(scratch), &head_len);
 
-    while (sent_total < len) {
-        ssize_t sent = send(ctx->fd, buf, len, 0);
-        if (sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                coro_sleep_fd(ctx->fd, EPOLLOUT);
-                continue;
-            } else {
-                perror("send");
-                break;
-            }
-        }
-        sent_total += (size_t) sent;
+    // More requests are waiting behind this one: hold the response back so the
+    // whole batch leaves in one write. The body has to be copied for that, since
+    // the handler's memory is gone by the time the batch is flushed.
+    if (ctx->pipelined && ctx->keep_alive && ctx->out_len + head_len + res->body.len <= PIPELINE_FLUSH_SIZE) {
+        out_append(ctx, head, head_len);
+        out_append(ctx, res->body.ptr, res->body.len);
+        if (head != scratch) free(head);
+        return;
     }
 
-    darr_deinit(&res->headers.other);
+    // The body goes out straight from the handler's buffer
+    struct iovec iov[2] = {
+        { .iov_base = head, .iov_len = head_len },
+        { .iov_base = (void *) res->body.ptr, .iov_len = res->body.len },
+    };
+
+    ctx_send(ctx, iov, res->body.len ? 2 : 1, 0);
+    if (head != scratch) free(head);
+
+    ctx_response_done(ctx);
+}
+
+void feather_response_begin(FeatherCtx *ctx, FeatherResponse *res) {
+    if (!ctx || ctx->fd < 0 || !res || ctx->streaming) return;
+    ctx->status = res->status;
 
     if (!ctx->keep_alive) {
-        close(ctx->fd);
-        counter -= 1;
+        res->headers.connection = SV_LIT("close");
+    }
+
+    res->headers.content_length = sv_from_buf(NULL, 0);
+    res->body = sv_from_buf(NULL, 0);
+    if (!res->headers.arena && !res->headers.other.cap) res->headers.arena = &ctx->arena;
+    feather_set_header(&res->headers, SV_LIT("Transfer-Encoding"), SV_LIT("chunked"));
+
+    char scratch[1024];
+    size_t head_len;
+    char *head = head_serialize(res, scratch, sizeof(scratch), &head_len);
+
+    // Sent right away, pipelined or not, so the client sees the first byte early
+    struct iovec iov = { .iov_base = head, .iov_len = head_len };
+    int sent = ctx_send(ctx, &iov, 1, 0);
+    if (head != scratch) free(head);
+
+    ctx->streaming = 1;
+    if (sent < 0) ctx->stream_failed = 1;
+}
+
+int feather_response_write_chunk(FeatherCtx *ctx, StrView data) {
+    if (!ctx || !ctx->streaming || ctx->stream_failed) return -1;
+
+    // An empty chunk would end the body
+    if (data.len == 0) return 0;
+
+    // The size line: hex digits, then CRLF
+    char size[20];
+    char *p = size + sizeof(size);
+    *--p = '\n';
+    *--p = '\r';
+    for (size_t len = data.len; len; len >>= 4) *--p = "0123456789abcdef"[len & 15];
+
+    // Parks the handler whenever the socket buffer is full
+    struct iovec iov[3] = {
+        { .iov_base = p, .iov_len = (size_t) (size + sizeof(size) - p) },
+        { .iov_base = (void *) data.ptr, .iov_len = data.len },
+        { .iov_base = "\r\n", .iov_len = 2 },
+    };
+
+    if (ctx_send(ctx, iov, 3, 0) < 0) {
+        ctx->stream_failed = 1;
+        return -1;
     }
+
+    return 0;
+}
+
+void feather_response_end(FeatherCtx *ctx) {
+    if (!ctx || !ctx->streaming) return;
+
+    if (!ctx->stream_failed) {
+        struct iovec iov = { .iov_base = "0\r\n\r\n", .iov_len = 5 };
+        ctx_send(ctx, &iov, 1, 0);
+    }
+
+    ctx->streaming = 0;
+    ctx->stream_failed = 0;
+    ctx_response_done(ctx);
+}
+
+void feather_response_init(FeatherCtx *ctx, FeatherResponse *res) {
+    *res = (FeatherResponse) {0};
+    if (ctx) res->headers.arena = &ctx->arena;
+}
+
+void *feather_alloc(FeatherCtx *ctx, size_t size) {
+    return feather_arena_alloc(&ctx->arena, size);
+}
+
+StrView feather_sprintf(FeatherCtx *ctx, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    StrView out = feather_arena_vsprintf(&ctx->arena, fmt, args);
+    va_end(args);
+    return out;
+}
+
+ssize_t feather_request_read(FeatherCtx *ctx, void *buf, size_t n) {
+    if (!ctx || ctx->fd < 0) return -1;
+
+    return body_read(ctx, buf, n);
 }
 
 void feather_sleep_fd(int fd, int events) {
     coro_sleep_fd(fd, events);
 }
 
+int feather_sleep_fd_timeout(int fd, int events, int ms) {
+    return coro_sleep_fd_timeout(fd, events, ms);
+}
+
 void feather_sleep_ms(int ms) {
     coro_sleep_ms(ms);
 }
+
+void feather_set_stack_size(size_t size) {
+    coro_set_stack_size(size);
+}
+
+void feather_set_work_stealing(int enabled) {
+    work_stealing = enabled;
+}
+
+void feather_set_backend(FeatherBackend backend) {
+    switch (backend) {
+        case FEATHER_BACKEND_EPOLL: coro_set_backend(CORO_BACKEND_EPOLL); break;
+        case FEATHER_BACKEND_URING: coro_set_backend(CORO_BACKEND_URING); break;
+        default: coro_set_backend(CORO_BACKEND_AUTO); break;
+    }
+}
@@ -0,0 +1,350 @@
+#include "log.h"
+#include "dyn_arr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+    LOG_MESSAGE,
+    LOG_REQUEST,
+    LOG_ACCESS,
+} LogKind;
+
+// Written into the ring as is, followed by `text_len` bytes of text
+typedef struct {
+    uint16_t kind;
+    uint16_t method;
+    uint16_t status;
+    uint16_t text_len;
+    uint64_t time_ns;
+    uint64_t duration_us;
+} LogRecord;
+
+// Single producer, the thread owning it; single consumer, the writer thread. Positions
+// only grow and are taken modulo the size, each on its own cache line.
+typedef struct {
+    uint64_t head __attribute__((aligned(64)));
+    // The producer's last look at `tail`, so it reloads it only when the ring seems full
+    uint64_t tail_seen;
+    uint64_t dropped;
+
+    uint64_t tail __attribute__((aligned(64)));
+    // Set once the owning thread is gone; the writer frees the ring when it's drained
+    int orphaned;
+
+    char data[LOG_RING_SIZE] __attribute__((aligned(64)));
+} LogRing;
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static int stopping = 0;
+
+// Guards the ring list and the output fd; producers only take it to register
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static DynArr(LogRing *) rings = {0};
+static int out_fd = STDOUT_FILENO;
+// Drops of rings that were already freed
+static uint64_t retired_drops = 0;
+
+thread_local static LogRing *mine = NULL;
+
+static void ring_put(LogRing *ring, uint64_t at, const void *src, size_t n) {
+    size_t off = at & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - off < n ? LOG_RING_SIZE - off : n;
+    memcpy(ring->data + off, src, first);
+    memcpy(ring->data, (const char *) src + first, n - first);
+}
+
+static void ring_get(const LogRing *ring, uint64_t at, void *dst, size_t n) {
+    size_t off = at & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - off < n ? LOG_RING_SIZE - off : n;
+    memcpy(dst, ring->data + off, first);
+    memcpy((char *) dst + first, ring->data, n - first);
+}
+
+static void ring_orphan(void *arg) {
+    LogRing *ring = arg;
+    __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void *writer_loop(void *arg);
+
+static void log_stop(void) {
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+}
+
+static void log_start(void) {
+    pthread_key_create(&ring_key, ring_orphan);
+
+    int err = pthread_create(&writer, NULL, writer_loop, NULL);
+    if (err) {
+        errno = err;
+        perror("pthread_create");
+        exit(1);
+    }
+
+    // Whatever is still in the rings gets written on the way out
+    atexit(log_stop);
+}
+
+static LogRing *log_ring(void) {
+    if (mine) return mine;
+
+    pthread_once(&start_once, log_start);
+
+    if (posix_memalign((void **) &mine, 64, sizeof(LogRing)) != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+    memset(mine, 0, offsetof(LogRing, data));
+    pthread_setspecific(ring_key, mine);
+
+    pthread_mutex_lock(&rings_lock);
+    darr_push(&rings, mine);
+    pthread_mutex_unlock(&rings_lock);
+
+    return mine;
+}
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// `text` is `a` followed by `b`, cut at LOG_MAX_TEXT
+static void log_push(LogRecord *rec, StrView a, StrView b) {
+    LogRing *ring = log_ring();
+
+    if (a.len > LOG_MAX_TEXT) a.len = LOG_MAX_TEXT;
+    if (b.len > LOG_MAX_TEXT - a.len) b.len = LOG_MAX_TEXT - a.len;
+    rec->text_len = (uint16_t) (a.len + b.len);
+
+    size_t len = sizeof(LogRecord) + rec->text_len;
+    uint64_t head = ring->head;
+
+    if (head + len - ring->tail_seen > LOG_RING_SIZE) {
+        ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head + len - ring->tail_seen > LOG_RING_SIZE) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    ring_put(ring, head, rec, sizeof(LogRecord));
+    ring_put(ring, head + sizeof(LogRecord), a.ptr, a.len);
+    ring_put(ring, head + sizeof(LogRecord) + a.len, b.ptr, b.len);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
+
+void feather_log(const char *fmt, ...) {
+    char text[LOG_MAX_TEXT];
+
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (n < 0) return;
+    if ((size_t) n >= sizeof(text)) n = sizeof(text) - 1;
+
+    LogRecord rec = { .kind = LOG_MESSAGE, .time_ns = wall_ns() };
+    log_push(&rec, sv_from_buf(text, (size_t) n), sv_from_buf(NULL, 0));
+}
+
+void feather_log_request(const FeatherRequest *req) {
+    LogRecord rec = { .kind = LOG_REQUEST, .method = (uint16_t) req->method, .time_ns = wall_ns() };
+    log_push(&rec, req->path, sv_from_buf(NULL, 0));
+}
+
+void log_access(FeatherMethod method, StrView path, StrView query, int status, uint64_t duration_us) {
+    LogRecord rec = {
+        .kind = LOG_ACCESS,
+        .method = (uint16_t) method,
+        .status = (uint16_t) status,
+        .time_ns = wall_ns(),
+        .duration_us = duration_us,
+    };
+
+    // The '?' rides along at the end of the path if it's still in the request buffer
+    if (query.len > 0 && query.ptr == path.ptr + path.len + 1) {
+        path.len += 1 + query.len;
+        query = sv_from_buf(NULL, 0);
+    }
+
+    log_push(&rec, path, query);
+}
+
+int feather_log_open(const char *path) {
+    int fd = STDOUT_FILENO;
+    if (path) {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) return -1;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    int old = out_fd;
+    out_fd = fd;
+    pthread_mutex_unlock(&rings_lock);
+
+    if (old != STDOUT_FILENO) close(old);
+    return 0;
+}
+
+uint64_t feather_log_dropped(void) {
+    pthread_mutex_lock(&rings_lock);
+    uint64_t total = retired_drops;
+    darr_foreach(LogRing *, &rings, ring) {
+        total += __atomic_load_n(&(*ring)->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    return total;
+}
+
+typedef struct {
+    char buf[64 * 1024];
+    size_t len;
+
+    // Formatted once per second rather than once per line
+    time_t stamp_sec;
+    char stamp[32];
+    size_t stamp_len;
+} Output;
+
+static void output_flush(Output *out) {
+    size_t off = 0;
+    while (off < out->len) {
+        ssize_t n = write(out_fd, out->buf + off, out->len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Nowhere to report it; the lines are lost
+            break;
+        }
+        off += (size_t) n;
+    }
+    out->len = 0;
+}
+
+static void output_stamp(Output *out, uint64_t time_ns) {
+    time_t sec = (time_t) (time_ns / 1000000000);
+    if (sec != out->stamp_sec || out->stamp_len == 0) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        out->stamp_sec = sec;
+        out->stamp_len = strftime(out->stamp, sizeof(out->stamp), "[%Y-%m-%d %H:%M:%S] ", &tm);
+    }
+
+    memcpy(out->buf + out->len, out->stamp, out->stamp_len);
+    out->len += out->stamp_len;
+}
+
+// Room for one line: the stamp, the text and what's formatted around it
+#define LOG_LINE_MAX (LOG_MAX_TEXT + 128)
+
+static void output_record(Output *out, const LogRecord *rec, const char *text) {
+    if (sizeof(out->buf) - out->len < LOG_LINE_MAX) output_flush(out);
+
+    output_stamp(out, rec->time_ns);
+
+    char *p = out->buf + out->len;
+    if (rec->kind != LOG_MESSAGE) {
+        const char *method = feather_method_to_str((FeatherMethod) rec->method);
+        size_t method_len = strlen(method);
+        memcpy(p, method, method_len);
+        p += method_len;
+        *p++ = ' ';
+    }
+
+    memcpy(p, text, rec->text_len);
+    p += rec->text_len;
+
+    if (rec->kind == LOG_ACCESS) {
+        p += snprintf(p, 64, " %u %luus", (unsigned) rec->status, (unsigned long) rec->duration_us);
+    }
+
+    *p++ = '\n';
+    out->len = (size_t) (p - out->buf);
+}
+
+static size_t drain(LogRing *ring, Output *out) {
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t records = 0;
+
+    char text[LOG_MAX_TEXT];
+    while (tail < head) {
+        LogRecord rec;
+        ring_get(ring, tail, &rec, sizeof(rec));
+        ring_get(ring, tail + sizeof(rec), text, rec.text_len);
+        tail += sizeof(rec) + rec.text_len;
+
+        output_record(out, &rec, text);
+        records += 1;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return records;
+}
+
+static void *writer_loop(void *arg) {
+    (void) arg;
+
+    Output *out = calloc(1, sizeof(Output));
+    uint64_t reported = 0;
+
+    while (1) {
+        // Stopping still takes one more pass, which sees everything logged before exit
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&rings_lock);
+
+        size_t records = 0;
+        uint64_t dropped = retired_drops;
+        for (size_t i = 0; i < rings.size; ) {
+            LogRing *ring = rings.items[i];
+            int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+
+            records += drain(ring, out);
+            uint64_t ring_dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            dropped += ring_dropped;
+
+            // Orphaned before the drain, so nothing can have been added since
+            if (orphaned) {
+                retired_drops += ring_dropped;
+                rings.items[i] = rings.items[--rings.size];
+                free(ring);
+                continue;
+            }
+            i += 1;
+        }
+
+        if (dropped > reported) {
+            char note[64];
+            int n = snprintf(note, sizeof(note), "feather: dropped %lu log records", (unsigned long) (dropped - reported));
+            LogRecord rec = { .kind = LOG_MESSAGE, .text_len = (uint16_t) n, .time_ns = wall_ns() };
+            output_record(out, &rec, note);
+            reported = dropped;
+        }
+
+        output_flush(out);
+        pthread_mutex_unlock(&rings_lock);
+
+        if (stop) break;
+        if (records == 0) {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = LOG_IDLE_SLEEP_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    free(out);
+    return NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include "feather.h"
+#include <stdint.h>
+
+// Each thread that logs gets a ring of this many bytes, which the writer thread drains.
+// A record that doesn't fit is dropped and counted instead of waiting for room.
+#define LOG_RING_SIZE (256 * 1024)
+// Longer messages and paths are cut
+#define LOG_MAX_TEXT 1024
+// How long the writer sleeps after finding every ring empty
+#define LOG_IDLE_SLEEP_MS 5
+
+// One line per request, written as `[time] METHOD /path?query status duration`
+void log_access(FeatherMethod method, StrView path, StrView query, int status, uint64_t duration_us);
+
+#endif
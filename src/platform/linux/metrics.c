@@ -0,0 +1,286 @@
+#include "metrics.h"
+#include "coro.h"
+#include "trace.h"
+#include "dyn_arr.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+} Histogram;
+
+// One per worker, written only by it. Scrapes read it concurrently, so every store is a
+// relaxed atomic: a plain move on x86-64, but never seen half-written.
+typedef struct {
+    uint64_t connections;
+    uint64_t responses[6];  // by status / 100, 0 for none or out of range
+    Histogram *series;
+} WorkerMetrics;
+
+#define BUMP(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+#define READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static const FeatherApp *app = NULL;
+static size_t series_count = METRICS_EXTRA_SERIES;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static DynArr(WorkerMetrics *) registry = {0};
+thread_local static WorkerMetrics *mine = NULL;
+
+void metrics_init(const FeatherApp *metrics_app) {
+    app = metrics_app;
+    series_count = app->route_count + METRICS_EXTRA_SERIES;
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static WorkerMetrics *worker_metrics(void) {
+    if (mine) return mine;
+
+    mine = calloc(1, sizeof(WorkerMetrics));
+    mine->series = calloc(series_count, sizeof(Histogram));
+
+    pthread_mutex_lock(&registry_lock);
+    darr_push(&registry, mine);
+    pthread_mutex_unlock(&registry_lock);
+
+    return mine;
+}
+
+static size_t bucket_of(uint64_t us) {
+    if (us < 2) return (size_t) us;
+
+    size_t octave = (size_t) (63 - __builtin_clzll(us));
+    size_t bucket = octave * 2 + ((us >> (octave - 1)) & 1);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+// Exclusive upper bound of a bucket, in microseconds
+static uint64_t bucket_bound(size_t bucket) {
+    if (bucket < 2) return bucket + 1;
+
+    size_t octave = bucket / 2;
+    return ((uint64_t) (3 + bucket % 2)) << (octave - 1);
+}
+
+void metrics_request(size_t series, int status, uint64_t latency_us) {
+    WorkerMetrics *m = worker_metrics();
+
+    int class = status >= 100 && status < 600 ? status / 100 : 0;
+    BUMP(m->responses[class], 1);
+
+    if (series >= series_count) return;
+
+    Histogram *h = &m->series[series];
+    BUMP(h->buckets[bucket_of(latency_us)], 1);
+    BUMP(h->count, 1);
+    BUMP(h->sum_us, latency_us);
+}
+
+void metrics_connection(void) {
+    WorkerMetrics *m = worker_metrics();
+    BUMP(m->connections, 1);
+}
+
+typedef struct {
+    char *ptr;
+    size_t len;
+    size_t cap;
+} Text;
+
+__attribute__((format(printf, 2, 3)))
+static void text_printf(Text *text, const char *fmt, ...) {
+    while (1) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(text->ptr + text->len, text->cap - text->len, fmt, args);
+        va_end(args);
+
+        if (n < 0) return;
+        if ((size_t) n < text->cap - text->len) {
+            text->len += (size_t) n;
+            return;
+        }
+
+        text->cap = text->cap ? text->cap * 2 : 4096;
+        if (text->cap < text->len + (size_t) n + 1) text->cap = text->len + (size_t) n + 1;
+        text->ptr = realloc(text->ptr, text->cap);
+    }
+}
+
+// A route pattern as a label value: backslashes and quotes escaped
+static void text_label(Text *text, StrView value) {
+    for (size_t i = 0; i < value.len; ++i) {
+        char c = value.ptr[i];
+        if (c == '\\' || c == '"') text_printf(text, "\\%c", c);
+        else if (c == '\n') text_printf(text, "\\n");
+        else text_printf(text, "%c", c);
+    }
+}
+
+static void render_histograms(Text *text) {
+    Histogram *totals = calloc(series_count, sizeof(Histogram));
+    uint64_t connections = 0;
+    uint64_t responses[6] = {0};
+
+    pthread_mutex_lock(&registry_lock);
+    darr_foreach(WorkerMetrics *, &registry, it) {
+        WorkerMetrics *m = *it;
+        connections += READ(m->connections);
+        for (size_t c = 0; c < 6; ++c) responses[c] += READ(m->responses[c]);
+
+        for (size_t s = 0; s < series_count; ++s) {
+            for (size_t b = 0; b < METRICS_BUCKETS; ++b) totals[s].buckets[b] += READ(m->series[s].buckets[b]);
+            totals[s].count += READ(m->series[s].count);
+            totals[s].sum_us += READ(m->series[s].sum_us);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    text_printf(text, "# HELP feather_connections_accepted_total Connections accepted.\n");
+    text_printf(text, "# TYPE feather_connections_accepted_total counter\n");
+    text_printf(text, "feather_connections_accepted_total %lu\n", connections);
+
+    text_printf(text, "# HELP feather_responses_total Requests answered, by status class.\n");
+    text_printf(text, "# TYPE feather_responses_total counter\n");
+    for (size_t c = 1; c < 6; ++c) text_printf(text, "feather_responses_total{code=\"%zuxx\"} %lu\n", c, responses[c]);
+    text_printf(text, "feather_responses_total{code=\"none\"} %lu\n", responses[0]);
+
+    text_printf(text, "# HELP feather_request_duration_seconds Time from a request's head arriving to its response being sent.\n");
+    text_printf(text, "# TYPE feather_request_duration_seconds histogram\n");
+
+    for (size_t s = 0; s < series_count; ++s) {
+        const Histogram *h = &totals[s];
+        if (h->count == 0) continue;
+
+        size_t route_count = series_count - METRICS_EXTRA_SERIES;
+        Text labels = {0};
+        if (s < route_count) {
+            text_printf(&labels, "method=\"%s\",route=\"", feather_method_to_str(app->routes[s].method));
+            text_label(&labels, app->routes[s].pattern);
+            text_printf(&labels, "\"");
+        } else {
+            static const char *const extra[METRICS_EXTRA_SERIES] = {
+                [METRICS_SERIES_STATIC] = "static",
+                [METRICS_SERIES_NOT_FOUND] = "not_found",
+                [METRICS_SERIES_BAD_REQUEST] = "bad_request",
+            };
+            text_printf(&labels, "route=\"%s\"", extra[s - route_count]);
+        }
+
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b + 1 < METRICS_BUCKETS; ++b) {
+            cumulative += h->buckets[b];
+            text_printf(text, "feather_request_duration_seconds_bucket{%s,le=\"%g\"} %lu\n", labels.ptr, (double) bucket_bound(b) / 1e6, cumulative);
+        }
+        text_printf(text, "feather_request_duration_seconds_bucket{%s,le=\"+Inf\"} %lu\n", labels.ptr, h->count);
+        text_printf(text, "feather_request_duration_seconds_sum{%s} %.6f\n", labels.ptr, (double) h->sum_us / 1e6);
+        text_printf(text, "feather_request_duration_seconds_count{%s} %lu\n", labels.ptr, h->count);
+
+        free(labels.ptr);
+    }
+
+    free(totals);
+}
+
+static void render_cache(Text *text) {
+    FeatherCacheStats st;
+    feather_cache_stats(&st);
+
+    text_printf(text, "# TYPE feather_cache_hits_total counter\nfeather_cache_hits_total %lu\n", st.hits);
+    text_printf(text, "# TYPE feather_cache_misses_total counter\nfeather_cache_misses_total %lu\n", st.misses);
+    text_printf(text, "# TYPE feather_cache_stores_total counter\nfeather_cache_stores_total %lu\n", st.stores);
+    text_printf(text, "# TYPE feather_cache_evictions_total counter\nfeather_cache_evictions_total %lu\n", st.evictions);
+    text_printf(text, "# TYPE feather_cache_bytes gauge\nfeather_cache_bytes %zu\n", st.bytes);
+    text_printf(text, "# TYPE feather_cache_entries gauge\nfeather_cache_entries %zu\n", st.entries);
+}
+
+static void render_log(Text *text) {
+    text_printf(text, "# HELP feather_log_dropped_total Log records dropped because their thread's ring was full.\n");
+    text_printf(text, "# TYPE feather_log_dropped_total counter\nfeather_log_dropped_total %lu\n", (unsigned long) feather_log_dropped());
+}
+
+static void render_scheduler(Text *text) {
+    size_t count = coro_stats(NULL, 0);
+    CoroStats *stats = calloc(count ? count : 1, sizeof(CoroStats));
+    count = coro_stats(stats, count);
+
+    static const struct { const char *name; const char *type; const char *help; size_t offset; double scale; } gauges[] = {
+        { "feather_scheduler_ready", "gauge", "Runnable coroutines after the last poll.", offsetof(CoroStats, ready), 1 },
+        { "feather_scheduler_sleeping", "gauge", "Coroutines waiting on an fd, a timer or a wakeup.", offsetof(CoroStats, sleeping), 1 },
+        { "feather_scheduler_hibernated", "gauge", "Idle keep-alive connections held without a coroutine.", offsetof(CoroStats, hibernated), 1 },
+        { "feather_polls_total", "counter", "Waits for I/O readiness or completions.", offsetof(CoroStats, polls), 1 },
+        { "feather_poll_events_total", "counter", "Events or completions those waits returned.", offsetof(CoroStats, events), 1 },
+        { "feather_poll_batch", "gauge", "Events the last wait returned.", offsetof(CoroStats, last_batch), 1 },
+        { "feather_loop_lag_seconds", "gauge", "Time the last pass ran coroutines before polling again.", offsetof(CoroStats, lag_us), 1e-6 },
+        { "feather_loop_busy_seconds_total", "counter", "Time spent running coroutines between polls.", offsetof(CoroStats, busy_us), 1e-6 },
+    };
+
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); ++g) {
+        text_printf(text, "# HELP %s %s\n# TYPE %s %s\n", gauges[g].name, gauges[g].help, gauges[g].name, gauges[g].type);
+
+        for (size_t w = 0; w < count; ++w) {
+            uint64_t value;
+            memcpy(&value, (const char *) &stats[w] + gauges[g].offset, sizeof(value));
+            text_printf(text, "%s{worker=\"%zu\"} %g\n", gauges[g].name, w, (double) value * gauges[g].scale);
+        }
+    }
+
+    free(stats);
+}
+
+static void metrics_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    (void) req;
+
+    Text text = {0};
+    render_histograms(&text);
+    render_cache(&text);
+    render_scheduler(&text);
+    render_log(&text);
+
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+    res.status = 200;
+    res.headers.content_type = SV_LIT("text/plain; version=0.0.4; charset=utf-8");
+    res.body = sv_from_buf(text.ptr, text.len);
+    feather_response_send(ctx, &res);
+
+    free(text.ptr);
+}
+
+void feather_metrics(FeatherApp *feather_app, const char *path) {
+    feather_get(feather_app, path, metrics_handler);
+}
+
+static void trace_handler(const FeatherRequest *req, FeatherCtx *ctx) {
+    (void) req;
+
+    char *json = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&json, &len);
+    trace_write_json(out);
+    fclose(out);
+
+    FeatherResponse res;
+    feather_response_init(ctx, &res);
+    res.status = 200;
+    res.headers.content_type = SV_LIT("application/json");
+    res.body = sv_from_buf(json, len);
+    feather_response_send(ctx, &res);
+
+    free(json);
+}
+
+void feather_trace(FeatherApp *feather_app, const char *path) {
+    feather_get(feather_app, path, trace_handler);
+}
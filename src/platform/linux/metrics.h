@@ -0,0 +1,27 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "feather.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Latency buckets: two per power of two of microseconds, so each bound is within
+// 50% of the one before it. The last one also takes everything past ~70 minutes.
+#define METRICS_BUCKETS 64
+
+// Requests that reached no route are counted under these, after the app's routes
+#define METRICS_SERIES_STATIC 0
+#define METRICS_SERIES_NOT_FOUND 1
+#define METRICS_SERIES_BAD_REQUEST 2    // heads that couldn't be parsed, so there's nothing to route by
+#define METRICS_EXTRA_SERIES 3
+
+// Sizes every worker's histograms; call once the app is frozen, before the workers start
+void metrics_init(const FeatherApp *app);
+
+uint64_t metrics_now_us(void);
+// Recorded on the calling worker. `series` is a route index or app->route_count + METRICS_SERIES_*;
+// `status` 0 means the handler never answered.
+void metrics_request(size_t series, int status, uint64_t latency_us);
+void metrics_connection(void);
+
+#endif
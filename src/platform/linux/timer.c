@@ -0,0 +1,154 @@
+#include "timer.h"
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#define LEVEL_SHIFT(level) ((unsigned) (level) * TIMER_WHEEL_BITS)
+#define SLOT_MASK (TIMER_WHEEL_SIZE - 1)
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+// Timers are never linked at the current level 0 position, which has already been
+// looked at, except while cascading into it right before it fires
+static void wheel_link(TimerWheel *wheel, Timer *timer, int cascading) {
+    uint64_t expires = timer->expires;
+    if (expires < wheel->now || (expires == wheel->now && !cascading)) expires = wheel->now + 1;
+
+    // Lowest level where the expiry is less than a full turn ahead. Past the top
+    // level the timer parks in the last slot and gets placed again when it cascades.
+    unsigned level = 0;
+    uint64_t idx;
+    while (1) {
+        unsigned shift = LEVEL_SHIFT(level);
+        if ((expires >> shift) - (wheel->now >> shift) < TIMER_WHEEL_SIZE) {
+            idx = expires >> shift;
+            break;
+        }
+
+        if (level == TIMER_WHEEL_LEVELS - 1) {
+            idx = (wheel->now >> shift) + TIMER_WHEEL_SIZE - 1;
+            break;
+        }
+
+        level += 1;
+    }
+
+    unsigned slot = idx & SLOT_MASK;
+    Timer **head = &wheel->slots[level][slot];
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void wheel_unlink(TimerWheel *wheel, Timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+
+    if (!wheel->slots[timer->level][timer->slot]) {
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void timer_wheel_add(TimerWheel *wheel, Timer *timer, uint64_t expires, void *data) {
+    timer->expires = expires;
+    timer->data = data;
+    wheel_link(wheel, timer, 0);
+    wheel->count += 1;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer) {
+    if (!timer_pending(timer)) return;
+
+    wheel_unlink(wheel, timer);
+    wheel->count -= 1;
+}
+
+static inline uint64_t rotr64(uint64_t x, unsigned r) {
+    return (x >> r) | (x << ((64 - r) & 63));
+}
+
+// First tick after `now` at which an occupied slot comes due: a level 0 slot fires,
+// a higher one cascades. Slots are never occupied at the current position.
+static uint64_t wheel_next_tick(const TimerWheel *wheel) {
+    uint64_t best = UINT64_MAX;
+
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        uint64_t bits = wheel->occupied[level];
+        if (!bits) continue;
+
+        unsigned shift = LEVEL_SHIFT(level);
+        unsigned cur = (wheel->now >> shift) & SLOT_MASK;
+        unsigned dist = __builtin_ctzll(rotr64(bits, (cur + 1) & SLOT_MASK)) + 1;
+
+        uint64_t tick = ((wheel->now >> shift) + dist) << shift;
+        if (tick < best) best = tick;
+    }
+
+    return best;
+}
+
+static void wheel_cascade(TimerWheel *wheel, unsigned level, unsigned slot) {
+    Timer *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+
+    while (timer) {
+        Timer *next = timer->next;
+        wheel_link(wheel, timer, 1);
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now, void (*fire)(Timer *timer)) {
+    while (wheel->count > 0) {
+        uint64_t tick = wheel_next_tick(wheel);
+        if (tick > now) break;
+
+        wheel->now = tick;
+
+        for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+            unsigned shift = LEVEL_SHIFT(level);
+            if (tick & ((1ULL << shift) - 1)) continue;
+
+            unsigned slot = (tick >> shift) & SLOT_MASK;
+            if (wheel->slots[level][slot]) wheel_cascade(wheel, level, slot);
+        }
+
+        Timer *timer;
+        while ((timer = wheel->slots[0][tick & SLOT_MASK])) {
+            wheel_unlink(wheel, timer);
+            wheel->count -= 1;
+            fire(timer);
+        }
+    }
+
+    if (now > wheel->now) wheel->now = now;
+}
+
+int timer_wheel_timeout(const TimerWheel *wheel, uint64_t now) {
+    if (wheel->count == 0) return -1;
+
+    uint64_t tick = wheel_next_tick(wheel);
+    if (tick <= now) return 0;
+    if (tick - now > INT_MAX) return INT_MAX;
+
+    return (int) (tick - now);
+}
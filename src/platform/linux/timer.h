@@ -0,0 +1,51 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical hashed timer wheel with 1 ms ticks. Level l has 64 slots of 64^l ticks
+// each; a timer sits in the lowest level whose window still reaches its expiry and is
+// cascaded down as the wheel turns. Insert and cancel are O(1) list operations.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct Timer Timer;
+
+struct Timer {
+    Timer *next;
+    Timer **pprev;
+    uint64_t expires;
+    void *data;
+    uint8_t level;
+    uint8_t slot;
+};
+
+typedef struct {
+    Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    uint64_t now;
+    size_t count;
+} TimerWheel;
+
+// Milliseconds on CLOCK_MONOTONIC; served by the vDSO, not a syscall
+uint64_t timer_now_ms(void);
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now);
+void timer_wheel_add(TimerWheel *wheel, Timer *timer, uint64_t expires, void *data);
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer);
+
+// Fires, in expiry order, every timer due at or before `now`. A fired timer is
+// already unlinked when `fire` runs, so it may be re-added from there.
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now, void (*fire)(Timer *timer));
+
+// Milliseconds until the wheel next has work to do, or -1 when it's empty.
+// May be earlier than the next expiry when a far timer only needs to cascade.
+int timer_wheel_timeout(const TimerWheel *wheel, uint64_t now);
+
+static inline int timer_pending(const Timer *timer) {
+    return timer->pprev != NULL;
+}
+
+#endif
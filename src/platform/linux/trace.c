@@ -0,0 +1,180 @@
+#include "trace.h"
+#include "feather.h"
+#include "dyn_arr.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    uint64_t id;
+    uint64_t label;         // const char *
+    uint64_t label_len;
+    uint64_t phase_status;  // phase << 32 | status
+} TraceEvent;
+
+#define EVENT_WORDS (sizeof(TraceEvent) / sizeof(uint64_t))
+
+// Written only by its thread. A dump copies it while it's being written, so every word
+// is a relaxed atomic and anything `head` moved past during the copy is thrown away.
+typedef struct {
+    uint64_t head;
+    int tid;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+// Sampled when a random 64-bit number falls below this
+static uint64_t threshold = 0;
+static uint64_t next_id = 0;
+
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static DynArr(TraceBuffer *) buffers = {0};
+
+thread_local static TraceBuffer *mine = NULL;
+thread_local static uint64_t rng = 0;
+
+static const char *const phase_names[TRACE_PHASE_COUNT] = {
+    [TRACE_REQUEST] = "request",
+    [TRACE_RECV] = "recv",
+    [TRACE_PARSE] = "parse",
+    [TRACE_ROUTE] = "route",
+    [TRACE_BODY] = "body",
+    [TRACE_HANDLER] = "handler",
+    [TRACE_SEND] = "send",
+    [TRACE_PARK] = "park",
+};
+
+void feather_trace_sample(double rate) {
+    uint64_t t = 0;
+    if (rate >= 1) t = UINT64_MAX;
+    else if (rate > 0) t = (uint64_t) (rate * 18446744073709551616.0);
+    __atomic_store_n(&threshold, t, __ATOMIC_RELAXED);
+}
+
+uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t trace_sample(void) {
+    uint64_t t = __atomic_load_n(&threshold, __ATOMIC_RELAXED);
+    if (t == 0) return 0;
+
+    // xorshift64*, seeded per thread
+    if (rng == 0) rng = trace_now_ns() | 1;
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    if (t != UINT64_MAX && rng * 2685821657736338717ULL >= t) return 0;
+
+    return __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+}
+
+static TraceBuffer *trace_buffer(void) {
+    if (mine) return mine;
+
+    mine = calloc(1, sizeof(TraceBuffer));
+
+    pthread_mutex_lock(&buffers_lock);
+    mine->tid = (int) buffers.size;
+    darr_push(&buffers, mine);
+    pthread_mutex_unlock(&buffers_lock);
+
+    return mine;
+}
+
+void trace_span(uint64_t id, TracePhase phase, uint64_t start_ns, uint64_t end_ns, const char *label, size_t label_len, int status) {
+    TraceBuffer *buf = trace_buffer();
+
+    TraceEvent event = {
+        .start_ns = start_ns,
+        .dur_ns = end_ns > start_ns ? end_ns - start_ns : 0,
+        .id = id,
+        .label = (uint64_t) (uintptr_t) label,
+        .label_len = label_len,
+        .phase_status = (uint64_t) phase << 32 | (uint32_t) status,
+    };
+
+    uint64_t head = buf->head;
+    uint64_t *dst = (uint64_t *) &buf->events[head % TRACE_BUFFER_EVENTS];
+    const uint64_t *src = (const uint64_t *) &event;
+    for (size_t i = 0; i < EVENT_WORDS; ++i) __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_label(FILE *out, const char *label, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char) label[i];
+        if (c == '"' || c == '\\') fputc('\\', out);
+        if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+}
+
+static void write_buffer(FILE *out, const TraceBuffer *buf, int pid, int first) {
+    TraceEvent *copy = malloc(sizeof(buf->events));
+
+    uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    uint64_t from = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+    for (uint64_t n = from; n < head; ++n) {
+        const uint64_t *src = (const uint64_t *) &buf->events[n % TRACE_BUFFER_EVENTS];
+        uint64_t *dst = (uint64_t *) &copy[n % TRACE_BUFFER_EVENTS];
+        for (size_t i = 0; i < EVENT_WORDS; ++i) dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+
+    // Slots the thread reused while we copied may hold halves of two events
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&buf->head, __ATOMIC_RELAXED);
+    if (now > TRACE_BUFFER_EVENTS && now - TRACE_BUFFER_EVENTS > from) from = now - TRACE_BUFFER_EVENTS;
+
+    fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}",
+        first ? "" : ",\n", pid, buf->tid, buf->tid);
+
+    for (uint64_t n = from; n < head; ++n) {
+        const TraceEvent *event = &copy[n % TRACE_BUFFER_EVENTS];
+        TracePhase phase = (TracePhase) (event->phase_status >> 32);
+        if (phase >= TRACE_PHASE_COUNT) continue;
+
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"feather\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%lu",
+            phase_names[phase], event->start_ns / 1000.0, event->dur_ns / 1000.0, pid, buf->tid, (unsigned long) event->id);
+
+        if (phase == TRACE_REQUEST) fprintf(out, ",\"status\":%u", (unsigned) (uint32_t) event->phase_status);
+        if (event->label) {
+            fputs(",\"route\":\"", out);
+            write_label(out, (const char *) (uintptr_t) event->label, event->label_len);
+            fputc('"', out);
+        }
+
+        fputs("}}", out);
+    }
+
+    free(copy);
+}
+
+void trace_write_json(FILE *out) {
+    int pid = (int) getpid();
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+
+    pthread_mutex_lock(&buffers_lock);
+    for (size_t i = 0; i < buffers.size; ++i) {
+        write_buffer(out, buffers.items[i], pid, i == 0);
+    }
+    pthread_mutex_unlock(&buffers_lock);
+
+    fputs("\n]}\n", out);
+}
+
+int feather_trace_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) return -1;
+
+    trace_write_json(out);
+    return fclose(out);
+}
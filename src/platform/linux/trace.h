@@ -0,0 +1,34 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Spans each thread keeps; older ones are overwritten
+#define TRACE_BUFFER_EVENTS 16384
+
+typedef enum {
+    TRACE_REQUEST,
+    TRACE_RECV,     // from the first byte of a request's head to its last
+    TRACE_PARSE,
+    TRACE_ROUTE,
+    TRACE_BODY,
+    TRACE_HANDLER,
+    TRACE_SEND,
+    TRACE_PARK,     // a traced coroutine from coro_park to its wakeup
+    TRACE_PHASE_COUNT,
+} TracePhase;
+
+// 0 unless this request is picked by the sampling rate, else an id for its spans.
+// Costs one relaxed load while tracing is off.
+uint64_t trace_sample(void);
+uint64_t trace_now_ns(void);
+
+// Recorded in the calling thread's buffer. `label` must outlive the buffer, e.g. a
+// route pattern; `status` is only shown for TRACE_REQUEST.
+void trace_span(uint64_t id, TracePhase phase, uint64_t start_ns, uint64_t end_ns, const char *label, size_t label_len, int status);
+
+// Every thread's buffered spans as a Chrome trace-event JSON object
+void trace_write_json(FILE *out);
+
+#endif
@@ -0,0 +1,571 @@
+#ifndef FEATHER_NO_URING
+
+#include "uring.h"
+#include "coro.h"
+#include "dyn_arr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <threads.h>
+#include <unistd.h>
+
+typedef enum {
+    URING_ONESHOT,
+    URING_ACCEPT,
+    URING_WATCH,
+    URING_CALLBACK,
+} UringOpKind;
+
+// Every submission carries a pointer to one of these as user_data. One-shot ops
+// live on the stack of the coroutine that is parked waiting for them. `buf` is
+// where a recv that picked a provided buffer gets its data copied to.
+typedef struct {
+    UringOpKind kind;
+    Coro *coro;
+    void *buf;
+    int done;
+    int res;
+    unsigned flags;
+} UringOp;
+
+typedef struct {
+    UringOp op;
+    int sfd;
+    int armed;
+    int error;
+    DynArr(int) pending;
+} UringAcceptor;
+
+typedef struct {
+    UringOp op;
+    void (*done)(void *arg, int res);
+    void *arg;
+} UringCallback;
+
+typedef struct {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;
+    unsigned submitted;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *bufs;
+    unsigned short buf_tail;
+} Uring;
+
+thread_local static Uring ring;
+thread_local static DynArr(UringAcceptor *) acceptors = {0};
+thread_local static UringOp watch_op = { .kind = URING_WATCH };
+thread_local static int watch_armed = 0;
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void buf_recycle(unsigned short bid) {
+    struct io_uring_buf *buf = &ring.buf_ring->bufs[ring.buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (ring.bufs + (size_t) bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+
+    ring.buf_tail += 1;
+    __atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+static int buf_ring_init(void) {
+    ring.buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    ring.buf_ring = mmap(NULL, ring.buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring.buf_ring == MAP_FAILED) return -1;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) ring.buf_ring,
+        .ring_entries = URING_BUF_COUNT,
+        .bgid = URING_BUF_GROUP,
+    };
+
+    if (sys_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(ring.buf_ring, ring.buf_ring_size);
+        return -1;
+    }
+
+    ring.bufs = malloc((size_t) URING_BUF_COUNT * URING_BUF_SIZE);
+    ring.buf_tail = 0;
+    for (unsigned short i = 0; i < URING_BUF_COUNT; ++i) {
+        buf_recycle(i);
+    }
+
+    return 0;
+}
+
+int uring_init(void) {
+    struct io_uring_params p = {0};
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+
+    int fd = sys_uring_setup(URING_ENTRIES, &p);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        fd = sys_uring_setup(URING_ENTRIES, &p);
+    }
+    if (fd < 0) return -1;
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & required) != required) {
+        close(fd);
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    ring.fd = fd;
+    ring.ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring.ring_ptr = mmap(NULL, ring.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.ring_ptr == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        munmap(ring.ring_ptr, ring.ring_size);
+        close(fd);
+        return -1;
+    }
+
+    char *base = ring.ring_ptr;
+    ring.sq_head = (unsigned *) (base + p.sq_off.head);
+    ring.sq_tail = (unsigned *) (base + p.sq_off.tail);
+    ring.sq_flags = (unsigned *) (base + p.sq_off.flags);
+    ring.sq_mask = *(unsigned *) (base + p.sq_off.ring_mask);
+    ring.sq_entries = p.sq_entries;
+    ring.cq_head = (unsigned *) (base + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (base + p.cq_off.tail);
+    ring.cq_mask = *(unsigned *) (base + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (base + p.cq_off.cqes);
+
+    // The indirection array is never reordered, slot i always points at sqes[i]
+    unsigned *array = (unsigned *) (base + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    ring.sqe_tail = *ring.sq_tail;
+    ring.submitted = ring.sqe_tail;
+
+    if (buf_ring_init() < 0) {
+        munmap(ring.sqes, ring.sqes_size);
+        munmap(ring.ring_ptr, ring.ring_size);
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void uring_deinit(void) {
+    darr_foreach(UringAcceptor *, &acceptors, acceptor) {
+        if ((*acceptor)->pending.cap) darr_deinit(&(*acceptor)->pending);
+        free(*acceptor);
+    }
+    if (acceptors.cap) darr_deinit(&acceptors);
+    acceptors.size = acceptors.cap = 0;
+
+    free(ring.bufs);
+    munmap(ring.buf_ring, ring.buf_ring_size);
+    munmap(ring.sqes, ring.sqes_size);
+    munmap(ring.ring_ptr, ring.ring_size);
+    close(ring.fd);
+}
+
+// With `min_complete` set, waits for that many completions, but no longer than
+// `timeout_ms` unless it is negative
+static int uring_submit(unsigned min_complete, int timeout_ms) {
+    unsigned to_submit = ring.sqe_tail - ring.submitted;
+    unsigned flags = 0;
+
+    __atomic_store_n(ring.sq_tail, ring.sqe_tail, __ATOMIC_RELEASE);
+
+    if (min_complete > 0 || (__atomic_load_n(ring.sq_flags, __ATOMIC_RELAXED) & IORING_SQ_TASKRUN)) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    if (!to_submit && !flags) return 0;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    if (min_complete > 0 && timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int ret = sys_uring_enter(ring.fd, to_submit, min_complete, flags, argp, argsz);
+    if (ret < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+        return 0;
+    }
+
+    ring.submitted += (unsigned) ret;
+    return ret;
+}
+
+// Submissions are only queued here; they reach the kernel in one batch on the
+// next uring_run, after every runnable coroutine had its turn.
+static struct io_uring_sqe *uring_get_sqe(void) {
+    while (ring.sqe_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries) {
+        uring_submit(0, 0);
+    }
+
+    struct io_uring_sqe *sqe = &ring.sqes[ring.sqe_tail & ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sqe_tail += 1;
+
+    return sqe;
+}
+
+static void uring_complete(UringOp *op, int res, unsigned flags) {
+    switch (op->kind) {
+        case URING_ONESHOT:
+            // The provided buffer belongs to this ring, and the woken coroutine may
+            // be resumed by another worker, so hand the data over right here
+            if (flags & IORING_CQE_F_BUFFER) {
+                unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+                if (res > 0) memcpy(op->buf, ring.bufs + (size_t) bid * URING_BUF_SIZE, res);
+                buf_recycle(bid);
+            }
+
+            op->res = res;
+            op->flags = flags;
+            op->done = 1;
+            coro_wake(op->coro);
+            break;
+
+        case URING_WATCH:
+            op->done = 1;
+            watch_armed = 0;
+            break;
+
+        case URING_CALLBACK: {
+            UringCallback *callback = (UringCallback *) op;
+            callback->done(callback->arg, res);
+            free(callback);
+            break;
+        }
+
+        case URING_ACCEPT: {
+            UringAcceptor *acceptor = (UringAcceptor *) op;
+            if (res >= 0) {
+                darr_push(&acceptor->pending, res);
+            } else {
+                acceptor->error = -res;
+            }
+
+            if (!(flags & IORING_CQE_F_MORE)) acceptor->armed = 0;
+
+            if (acceptor->op.coro) {
+                Coro *waiter = acceptor->op.coro;
+                acceptor->op.coro = NULL;
+                coro_wake(waiter);
+            }
+            break;
+        }
+    }
+}
+
+int uring_run(int timeout_ms) {
+    unsigned head = *ring.cq_head;
+    int empty = head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    uring_submit(timeout_ms != 0 && empty ? 1 : 0, timeout_ms);
+
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+        UringOp *op = (UringOp *) (uintptr_t) cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+
+        head += 1;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        if (op) uring_complete(op, res, flags);
+        count += 1;
+
+        if (head == tail) tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    return count;
+}
+
+// Once the deadline passes the op is cancelled, but it still owns our stack until its
+// completion arrives, so we keep waiting for that. If it won the race, its result stands.
+static int uring_wait(UringOp *op, uint64_t deadline) {
+    Timer timer = {0};
+    int cancelled = 0;
+
+    if (deadline != CORO_NO_DEADLINE) coro_timer_add(&timer, deadline);
+
+    while (!op->done) {
+        coro_park();
+
+        if (!op->done && !cancelled && deadline != CORO_NO_DEADLINE && !timer_pending(&timer)) {
+            struct io_uring_sqe *sqe = uring_get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uint64_t) (uintptr_t) op;
+            cancelled = 1;
+        }
+    }
+
+    coro_timer_cancel(&timer);
+
+    if (cancelled && op->res == -ECANCELED) return -ETIMEDOUT;
+    return op->res;
+}
+
+int uring_poll(int fd, int events, uint64_t deadline) {
+    UringOp op = { .kind = URING_ONESHOT, .coro = coro_current() };
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = (unsigned) events;
+    sqe->user_data = (uint64_t) (uintptr_t) &op;
+
+    int res = uring_wait(&op, deadline);
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+
+    return res;
+}
+
+void *uring_poll_callback(int fd, int events, void (*done)(void *arg, int res), void *arg) {
+    UringCallback *callback = malloc(sizeof(UringCallback));
+    *callback = (UringCallback) { .op = { .kind = URING_CALLBACK }, .done = done, .arg = arg };
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = (unsigned) events;
+    sqe->user_data = (uint64_t) (uintptr_t) callback;
+
+    return callback;
+}
+
+void uring_cancel(void *handle) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uint64_t) (uintptr_t) handle;
+}
+
+void uring_watch_eventfd(int efd) {
+    if (watch_armed) return;
+
+    if (watch_op.done) {
+        uint64_t value;
+        while (read(efd, &value, sizeof(value)) > 0) {}
+    }
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = efd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uint64_t) (uintptr_t) &watch_op;
+
+    watch_op.done = 0;
+    watch_armed = 1;
+}
+
+static UringAcceptor *acceptor_get(int sfd) {
+    darr_foreach(UringAcceptor *, &acceptors, acceptor) {
+        if ((*acceptor)->sfd == sfd) return *acceptor;
+    }
+
+    // A multishot accept on a non-blocking socket completes with -EAGAIN right away
+    int flags = fcntl(sfd, F_GETFL, 0);
+    if (flags != -1 && (flags & O_NONBLOCK)) fcntl(sfd, F_SETFL, flags & ~O_NONBLOCK);
+
+    UringAcceptor *acceptor = calloc(1, sizeof(UringAcceptor));
+    acceptor->op.kind = URING_ACCEPT;
+    acceptor->sfd = sfd;
+    darr_push(&acceptors, acceptor);
+
+    return acceptor;
+}
+
+int uring_accept(int sfd) {
+    UringAcceptor *acceptor = acceptor_get(sfd);
+
+    while (acceptor->pending.size == 0) {
+        if (acceptor->error) {
+            errno = acceptor->error;
+            acceptor->error = 0;
+            return -1;
+        }
+
+        if (!acceptor->armed) {
+            struct io_uring_sqe *sqe = uring_get_sqe();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = sfd;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = (uint64_t) (uintptr_t) acceptor;
+            acceptor->armed = 1;
+        }
+
+        acceptor->op.coro = coro_current();
+        coro_park();
+    }
+
+    int cfd = acceptor->pending.items[acceptor->pending.size - 1];
+    darr_pop(&acceptor->pending);
+
+    return cfd;
+}
+
+ssize_t uring_recv(int fd, void *buf, size_t len, uint64_t deadline) {
+    // A zero length would let the kernel fill a whole provided buffer
+    if (len == 0) return 0;
+
+    int select_buf = 1;
+
+    while (1) {
+        UringOp op = { .kind = URING_ONESHOT, .coro = coro_current(), .buf = buf };
+
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->user_data = (uint64_t) (uintptr_t) &op;
+
+        if (select_buf) {
+            sqe->len = len < URING_BUF_SIZE ? len : URING_BUF_SIZE;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = URING_BUF_GROUP;
+        } else {
+            sqe->addr = (uint64_t) (uintptr_t) buf;
+            sqe->len = len;
+        }
+
+        int res = uring_wait(&op, deadline);
+
+        // Every provided buffer is taken, read straight into the caller's one instead
+        if (res == -ENOBUFS) {
+            select_buf = 0;
+            continue;
+        }
+
+        if (res == -EAGAIN) {
+            if (uring_poll(fd, POLLIN, deadline) < 0) return -1;
+            continue;
+        }
+
+        if (res < 0) {
+            errno = -res;
+            return -1;
+        }
+
+        return res;
+    }
+}
+
+ssize_t uring_sendmsg(int fd, const struct msghdr *msg, int flags, uint64_t deadline) {
+    while (1) {
+        UringOp op = { .kind = URING_ONESHOT, .coro = coro_current() };
+
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t) (uintptr_t) msg;
+        sqe->len = 1;
+        sqe->msg_flags = (unsigned) flags;
+        sqe->user_data = (uint64_t) (uintptr_t) &op;
+
+        int res = uring_wait(&op, deadline);
+
+        if (res == -EAGAIN) {
+            if (uring_poll(fd, POLLOUT, deadline) < 0) return -1;
+            continue;
+        }
+
+        if (res < 0) {
+            errno = -res;
+            return -1;
+        }
+
+        return res;
+    }
+}
+
+ssize_t uring_send(int fd, const void *buf, size_t len, int flags, uint64_t deadline) {
+    while (1) {
+        UringOp op = { .kind = URING_ONESHOT, .coro = coro_current() };
+
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t) (uintptr_t) buf;
+        sqe->len = len;
+        sqe->msg_flags = (unsigned) flags;
+        sqe->user_data = (uint64_t) (uintptr_t) &op;
+
+        int res = uring_wait(&op, deadline);
+
+        if (res == -EAGAIN) {
+            if (uring_poll(fd, POLLOUT, deadline) < 0) return -1;
+            continue;
+        }
+
+        if (res < 0) {
+            errno = -res;
+            return -1;
+        }
+
+        return res;
+    }
+}
+
+#endif
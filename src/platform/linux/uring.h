@@ -0,0 +1,45 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define URING_ENTRIES 256
+
+// Provided buffers for recv: the kernel picks one only once data has arrived
+#define URING_BUF_COUNT 256
+#define URING_BUF_SIZE (1024 * 4)
+#define URING_BUF_GROUP 0
+
+// Per-thread ring. Returns -1 if io_uring or one of the features we rely on
+// (multishot accept, provided buffer rings) isn't available.
+int uring_init(void);
+void uring_deinit(void);
+
+// Submits everything queued since the last call and dispatches completions.
+// Unless `timeout_ms` is 0, waits up to that long (forever if negative) for
+// at least one completion. Returns how many were dispatched.
+int uring_run(int timeout_ms);
+
+// These suspend the calling coroutine until the completion arrives and
+// follow the syscall convention: -1 with errno set on failure, ETIMEDOUT
+// once `deadline` (CORO_NO_DEADLINE for none) has passed.
+int uring_accept(int sfd);
+ssize_t uring_recv(int fd, void *buf, size_t len, uint64_t deadline);
+ssize_t uring_send(int fd, const void *buf, size_t len, int flags, uint64_t deadline);
+ssize_t uring_sendmsg(int fd, const struct msghdr *msg, int flags, uint64_t deadline);
+int uring_poll(int fd, int events, uint64_t deadline);
+
+// Polls `fd` without a coroutine waiting: `done(arg, res)` runs from uring_run with
+// the poll's result. Returns a handle for uring_cancel, valid until `done` has run.
+void *uring_poll_callback(int fd, int events, void (*done)(void *arg, int res), void *arg);
+// `done` still runs, with -ECANCELED unless the poll completed first
+void uring_cancel(void *handle);
+
+// Keeps a poll armed on an eventfd so writing to it interrupts uring_run.
+// Drains the counter once the poll has fired; call before every uring_run.
+void uring_watch_eventfd(int efd);
+
+#endif
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Generates the header name enum (include/feather_headers.h) and its perfect-hash
+# lookup table (src/core/header_table.h). Run from the repository root after
+# changing NAMES; both outputs are checked in.
+
+NAMES = [
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Accept-Ranges",
+    "Access-Control-Allow-Credentials", "Access-Control-Allow-Headers",
+    "Access-Control-Allow-Methods", "Access-Control-Allow-Origin",
+    "Access-Control-Expose-Headers", "Access-Control-Max-Age",
+    "Access-Control-Request-Headers", "Access-Control-Request-Method",
+    "Age", "Allow", "Authorization", "Cache-Control", "Connection",
+    "Content-Disposition", "Content-Encoding", "Content-Language", "Content-Length",
+    "Content-Location", "Content-Range", "Content-Security-Policy", "Content-Type",
+    "Cookie", "Date", "DNT", "ETag", "Expect", "Expires", "Forwarded", "From", "Host",
+    "If-Match", "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since",
+    "Keep-Alive", "Last-Modified", "Link", "Location", "Max-Forwards", "Origin",
+    "Pragma", "Proxy-Authenticate", "Proxy-Authorization", "Range", "Referer",
+    "Retry-After", "Sec-Fetch-Dest", "Sec-Fetch-Mode", "Sec-Fetch-Site", "Sec-Fetch-User",
+    "Server", "Set-Cookie", "Strict-Transport-Security", "TE", "Trailer",
+    "Transfer-Encoding", "Upgrade", "Upgrade-Insecure-Requests", "User-Agent", "Vary",
+    "Via", "WWW-Authenticate", "X-Content-Type-Options", "X-Forwarded-For",
+    "X-Forwarded-Host", "X-Forwarded-Proto", "X-Frame-Options", "X-Real-IP",
+    "X-Request-Id", "X-Requested-With",
+]
+
+TABLE_BITS = 8
+
+
+def key(name):
+    # Must match header_key in src/core/feather.c
+    n = len(name.encode())
+    b = name.lower().encode()
+    return b[0] | b[n - 1] << 8 | b[n - 3 if n >= 3 else 0] << 16 | n << 24
+
+
+def slot(k, seed):
+    return ((k * seed) & 0xFFFFFFFF) >> (32 - TABLE_BITS)
+
+
+def find_seed(keys):
+    seed = 0x9E3779B1
+    while True:
+        if len({slot(k, seed) for k in keys}) == len(keys):
+            return seed
+        seed = (seed * 0x5851F42D + 0x14057B7E) & 0xFFFFFFFF | 1
+
+
+def ident(name):
+    return "FEATHER_HEADER_" + name.upper().replace("-", "_")
+
+
+def main():
+    keys = [key(n) for n in NAMES]
+    assert len(set(keys)) == len(keys), "two names share a key, pick other characters"
+    seed = find_seed(keys)
+
+    with open("include/feather_headers.h", "w") as f:
+        f.write("// Generated by tools/gen_headers.py, do not edit\n\n")
+        f.write("#ifndef __FEATHER_HEADERS_H__\n#define __FEATHER_HEADERS_H__\n\n")
+        f.write("// Standard header names, interned when a header is set\n")
+        f.write("typedef enum {\n    FEATHER_HEADER_OTHER,\n")
+        for n in NAMES:
+            f.write(f"    {ident(n)},\n")
+        f.write("    FEATHER_HEADER_COUNT,\n} FeatherHeaderId;\n\n#endif\n")
+
+    table = [0] * (1 << TABLE_BITS)
+    for i, k in enumerate(keys):
+        table[slot(k, seed)] = i + 1
+
+    with open("src/core/header_table.h", "w") as f:
+        f.write("// Generated by tools/gen_headers.py, do not edit\n\n")
+        f.write(f"#define HEADER_TABLE_BITS {TABLE_BITS}\n")
+        f.write(f"#define HEADER_TABLE_SEED 0x{seed:08X}u\n\n")
+        f.write("// Canonical spelling of each FeatherHeaderId\n")
+        f.write("static const StrView header_names[FEATHER_HEADER_COUNT] = {\n")
+        f.write("    [FEATHER_HEADER_OTHER] = { NULL, 0 },\n")
+        for n in NAMES:
+            f.write(f"    [{ident(n)}] = SV_LIT(\"{n}\"),\n")
+        f.write("};\n\n")
+        f.write("// Hash slot to FeatherHeaderId, FEATHER_HEADER_OTHER where no name lands\n")
+        f.write(f"static const uint8_t header_slots[1 << HEADER_TABLE_BITS] = {{\n")
+        for i in range(0, len(table), 16):
+            f.write("    " + ", ".join(f"{v:2d}" for v in table[i:i + 16]) + ",\n")
+        f.write("};\n")
+
+
+if __name__ == "__main__":
+    main()